@@ -14,7 +14,9 @@
 #include "translate.h"
 
 #include <cstdlib>
+#include <algorithm>
 #include <fstream>
+#include <map>
 #include <sstream>
 
 extern "C" {
@@ -33,10 +35,26 @@ extern "C" {
 
 using namespace std;
 
-/* Adjust and run make_cmd to build a kernel module. */
-static int
-run_make_cmd(systemtap_session& s, vector<string>& make_cmd,
-             bool null_out=false, bool null_err=false)
+/* How many jobs to run at once, or 0 if we shouldn't run any in parallel. */
+static long
+build_parallelism()
+{
+  // Exploit SMP parallelism, if available.
+  long smp = sysconf(_SC_NPROCESSORS_ONLN);
+  if (smp <= 0) smp = 1;
+  // PR16276: but only if we're not running severely nproc-rlimited
+  struct rlimit rlim;
+  int rlimit_rc = getrlimit(RLIMIT_NPROC, &rlim);
+  const unsigned int severely_limited = smp*30; // WAG at number of gcc+make etc. nested processes
+  bool nproc_limited = (rlimit_rc == 0 && (rlim.rlim_max <= severely_limited || 
+                                           rlim.rlim_cur <= severely_limited));
+  return nproc_limited ? 0 : smp;
+}
+
+/* Adjust make_cmd to build a kernel module. */
+static void
+prepare_make_cmd(systemtap_session& s, vector<string>& make_cmd,
+                 bool& null_out)
 {
   assert_no_interrupts();
 
@@ -59,16 +77,8 @@ run_make_cmd(systemtap_session& s, vector<string>& make_cmd,
       make_cmd.push_back("--no-print-directory");
     }
 
-  // Exploit SMP parallelism, if available.
-  long smp = sysconf(_SC_NPROCESSORS_ONLN);
-  if (smp <= 0) smp = 1;
-  // PR16276: but only if we're not running severely nproc-rlimited
-  struct rlimit rlim;
-  int rlimit_rc = getrlimit(RLIMIT_NPROC, &rlim);
-  const unsigned int severely_limited = smp*30; // WAG at number of gcc+make etc. nested processes
-  bool nproc_limited = (rlimit_rc == 0 && (rlim.rlim_max <= severely_limited || 
-                                           rlim.rlim_cur <= severely_limited));
-  if (smp >= 1 && !nproc_limited)
+  long smp = build_parallelism();
+  if (smp >= 1)
     make_cmd.push_back("-j" + lex_cast(smp+1));
 
   if (strverscmp (s.kernel_base_release.c_str(), "2.6.29") < 0)
@@ -78,6 +88,14 @@ run_make_cmd(systemtap_session& s, vector<string>& make_cmd,
       // that with this bluntness.
       null_out = true;
     }
+}
+
+/* Adjust and run make_cmd to build a kernel module. */
+static int
+run_make_cmd(systemtap_session& s, vector<string>& make_cmd,
+             bool null_out=false, bool null_err=false)
+{
+  prepare_make_cmd(s, make_cmd, null_out);
 
   int rc = stap_system (s.verbose, "kbuild", make_cmd, null_out, null_err);
   if (rc != 0)
@@ -864,6 +882,27 @@ make_tracequeries(systemtap_session& s, const map<string,string>& contents)
 }
 
 
+// Write the kbuild Makefile lines to build one typequery object
+static void
+output_typequery_kmod(ofstream& omf, const string& basename,
+                      const vector<string>& headers)
+{
+  // NB: We use -include instead of #include because that gives us more power.
+  // Using #include searches relative to the source's path, which in this case
+  // is /tmp/..., so that's not helpful.  Using -include will search relative
+  // to the cwd, which will be the kernel build root.  This means if you have a
+  // full kernel build tree, it's possible to get at types that aren't in the
+  // normal include path, e.g.:
+  //    @cast(foo, "bsd_acct_struct", "kernel<kernel/acct.c>")->...
+  omf << "CFLAGS_" << basename << ".o :=";
+  for (size_t i = 0; i < headers.size(); ++i)
+    omf << " -include " << lex_cast_qstring(headers[i]); // XXX right quoting?
+  omf << endl;
+
+  omf << "obj-m += " + basename + ".o" << endl;
+}
+
+
 // Build a tiny kernel module to query type information
 static int
 make_typequery_kmod(systemtap_session& s, const vector<string>& headers, string& name)
@@ -890,19 +929,7 @@ make_typequery_kmod(systemtap_session& s, const vector<string>& headers, string&
   // RHBZ 655231: later rhel6 kernels' module-signing kbuild logic breaks out-of-tree modules
   omf << "CONFIG_MODULE_SIG := n" << endl;
 
-  // NB: We use -include instead of #include because that gives us more power.
-  // Using #include searches relative to the source's path, which in this case
-  // is /tmp/..., so that's not helpful.  Using -include will search relative
-  // to the cwd, which will be the kernel build root.  This means if you have a
-  // full kernel build tree, it's possible to get at types that aren't in the
-  // normal include path, e.g.:
-  //    @cast(foo, "bsd_acct_struct", "kernel<kernel/acct.c>")->...
-  omf << "CFLAGS_" << basename << ".o :=";
-  for (size_t i = 0; i < headers.size(); ++i)
-    omf << " -include " << lex_cast_qstring(headers[i]); // XXX right quoting?
-  omf << endl;
-
-  omf << "obj-m := " + basename + ".o" << endl;
+  output_typequery_kmod(omf, basename, headers);
   omf.close();
 
   // create our empty source file
@@ -920,16 +947,14 @@ make_typequery_kmod(systemtap_session& s, const vector<string>& headers, string&
 }
 
 
-// Build a tiny user module to query type information
-static int
-make_typequery_umod(systemtap_session& s, const vector<string>& headers, string& name)
+// Get the command to build a tiny user module to query type information
+static vector<string>
+make_typequery_umod_cmd(systemtap_session& s, const vector<string>& headers, string& name)
 {
   static unsigned tick = 0;
 
   name = s.tmpdir + "/typequery_umod_" + lex_cast(++tick) + ".so";
 
-  // make the module
-  //
   // NB: As with kmod, using -include makes relative paths more useful.  The
   // cwd in this case will be the cwd of stap itself though, which may be
   // trickier to deal with.  It might be better to "cd `dirname $script`"
@@ -948,6 +973,15 @@ make_typequery_umod(systemtap_session& s, const vector<string>& headers, string&
       cmd.push_back("-include");
       cmd.push_back(headers[i]);
     }
+  return cmd;
+}
+
+
+// Build a tiny user module to query type information
+static int
+make_typequery_umod(systemtap_session& s, const vector<string>& headers, string& name)
+{
+  vector<string> cmd = make_typequery_umod_cmd(s, headers, name);
   bool quiet = (s.verbose < 4);
   int rc = stap_system (s.verbose, cmd, quiet, quiet);
   if (rc)
@@ -956,12 +990,13 @@ make_typequery_umod(systemtap_session& s, const vector<string>& headers, string&
 }
 
 
-int
-make_typequery(systemtap_session& s, string& module)
+// Split a "<a.h><b.h>" or "kernel<a.h><b.h>" module into its headers.
+// Malformed headers are skipped with a warning, or if strict, make the
+// whole module fail quietly.
+static int
+typequery_headers(systemtap_session& s, const string& module,
+                  vector<string>& headers, bool strict=false)
 {
-  int rc;
-  string new_module;
-  vector<string> headers;
   bool kernel = startswith(module, "kernel");
 
   for (size_t end, i = kernel ? 6 : 0; i < module.size(); i = end + 1)
@@ -974,14 +1009,223 @@ make_typequery(systemtap_session& s, string& module)
       string header = module.substr(i, end - i);
       vector<string> matches;
       if (regexp_match(header, "^[a-zA-Z0-9/_.+-]+$", matches))
-        s.print_warning("skipping malformed @cast header \""+ header + "\"");
+        {
+          if (strict)
+            return -1;
+          s.print_warning("skipping malformed @cast header \""+ header + "\"");
+        }
       else
         headers.push_back(header);
     }
   if (headers.empty())
     return -1;
+  return 0;
+}
+
+
+// Typequeries are normally built one at a time, whenever pass 2 first
+// resolves a @cast that needs one.  start_typequeries() instead queues
+// the builds ahead of time: all the kernel typequeries share a single
+// kbuild run, and user typequeries each get a gcc, with no more than
+// build_parallelism() of these running at once.  They build in the
+// background while pass 2 goes on, and make_typequery() only has to
+// wait for the result.
+
+struct typequery_build
+{
+  string description;
+  vector<string> cmd;
+  bool null_out, null_err;
+  pid_t pid; // 0 while still queued
+  bool done;
+  int rc;
+
+  typequery_build(const string& description, const vector<string>& cmd,
+                  bool null_out, bool null_err):
+    description(description), cmd(cmd), null_out(null_out),
+    null_err(null_err), pid(0), done(false), rc(-1) {}
+};
+
+struct typequery_job
+{
+  typequery_build* build;
+  string name; // the module that the build will produce
+};
+
+typedef pair<systemtap_session*, string> typequery_key;
+static vector<typequery_build*> typequery_builds;
+static map<typequery_key, typequery_job> typequery_jobs;
+
+
+// Launch queued builds, as far as the parallelism allows
+static void
+launch_typequery_builds(systemtap_session& s)
+{
+  long limit = max(build_parallelism(), 1L);
+  long running = 0;
+  for (size_t i = 0; i < typequery_builds.size(); ++i)
+    if (typequery_builds[i]->pid > 0 && !typequery_builds[i]->done)
+      ++running;
+
+  for (size_t i = 0; i < typequery_builds.size() && running < limit; ++i)
+    {
+      typequery_build* b = typequery_builds[i];
+      if (b->pid != 0 || b->done)
+        continue;
+
+      b->pid = stap_spawn_quiet(s.verbose, b->cmd, b->null_out, b->null_err);
+      if (b->pid > 0)
+        ++running;
+      else
+        b->done = true;
+    }
+}
+
+
+// Wait for the given build, and for any queued ahead of it
+static void
+finish_typequery_build(systemtap_session& s, typequery_build* b)
+{
+  for (size_t i = 0; !b->done && i < typequery_builds.size(); ++i)
+    {
+      typequery_build* o = typequery_builds[i];
+      if (o->done)
+        continue;
+
+      // everything before o is done, so this is sure to launch it
+      if (o->pid == 0)
+        launch_typequery_builds(s);
+
+      if (o->pid > 0)
+        {
+          o->rc = stap_wait(s.verbose, o->description, o->pid);
+          o->done = true;
+          launch_typequery_builds(s);
+        }
+    }
+}
+
+
+void
+start_typequeries(systemtap_session& s, const vector<string>& modules)
+{
+  vector<pair<string, vector<string> > > kmods;
+  bool quiet = (s.verbose < 4);
+
+  for (size_t i = 0; i < modules.size(); ++i)
+    {
+      const string& module = modules[i];
+      typequery_key key(&s, module);
+      if (typequery_jobs.count(key))
+        continue;
+
+      // Leave anything odd for make_typequery() to complain about.
+      vector<string> headers;
+      if (typequery_headers(s, module, headers, true) != 0)
+        continue;
+
+      if (startswith(module, "kernel"))
+        {
+          kmods.push_back(make_pair(module, headers));
+          continue;
+        }
+
+      typequery_job& job = typequery_jobs[key];
+      vector<string> cmd = make_typequery_umod_cmd(s, headers, job.name);
+      job.build = new typequery_build(cmd.front(), cmd, quiet, quiet);
+      typequery_builds.push_back(job.build);
+    }
+
+  if (!kmods.empty())
+    {
+      static unsigned tick = 0;
+      string dir(s.tmpdir + "/typequery_kmods_" + lex_cast(++tick));
+      if (create_dir(dir.c_str()) == 0)
+        {
+          vector<string> make_cmd = make_make_cmd(s, dir);
+          make_cmd.push_back ("-i"); // ignore errors, so one bad header doesn't spoil the rest
+          bool null_out = quiet;
+          prepare_make_cmd(s, make_cmd, null_out);
+          typequery_build* b = new typequery_build("kbuild", make_cmd,
+                                                   null_out, quiet);
+
+          string makefile(dir + "/Makefile");
+          ofstream omf(makefile.c_str());
+          omf << "EXTRA_CFLAGS := -g -fno-eliminate-unused-debug-types" << endl;
+
+          // RHBZ 655231: later rhel6 kernels' module-signing kbuild logic breaks out-of-tree modules
+          omf << "CONFIG_MODULE_SIG := n" << endl;
+
+          for (size_t i = 0; i < kmods.size(); ++i)
+            {
+              string basename("typequery_kmod_" + lex_cast(i));
+              output_typequery_kmod(omf, basename, kmods[i].second);
+
+              // create our empty source file
+              string source(dir + "/" + basename + ".c");
+              ofstream osrc(source.c_str());
+              osrc.close();
+
+              typequery_job& job = typequery_jobs[typequery_key(&s, kmods[i].first)];
+              job.build = b;
+              job.name = dir + "/" + basename + ".ko";
+            }
+          omf.close();
+
+          typequery_builds.push_back(b);
+        }
+    }
+
+  launch_typequery_builds(s);
+}
+
+
+void
+finish_typequeries(systemtap_session& s)
+{
+  // Queued builds aren't needed any more, but the running ones must
+  // not be left behind writing into our tmpdir.
+  for (size_t i = 0; i < typequery_builds.size(); ++i)
+    {
+      typequery_build* b = typequery_builds[i];
+      if (b->pid > 0 && !b->done)
+        stap_waitpid(s.verbose, b->pid);
+      delete b;
+    }
+  typequery_builds.clear();
+  typequery_jobs.clear();
+}
+
+
+int
+make_typequery(systemtap_session& s, string& module)
+{
+  int rc;
+  string new_module;
+  vector<string> headers;
+
+  // If it was started ahead of time, we just need its result.
+  map<typequery_key, typequery_job>::iterator it =
+    typequery_jobs.find(typequery_key(&s, module));
+  if (it != typequery_jobs.end())
+    {
+      typequery_job job = it->second;
+      typequery_jobs.erase(it);
+
+      finish_typequery_build(s, job.build);
+      // NB: a kernel batch runs with make -i, so its rc means little.
+      rc = file_exists(job.name) ? 0 : 1;
+      if (rc)
+        s.set_try_server ();
+      else
+        module = job.name;
+      return rc;
+    }
+
+  if (typequery_headers(s, module, headers) != 0)
+    return -1;
 
-  if (kernel)
+  if (startswith(module, "kernel"))
       rc = make_typequery_kmod(s, headers, new_module);
   else
       rc = make_typequery_umod(s, headers, new_module);
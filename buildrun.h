@@ -20,6 +20,8 @@ std::vector<std::string> make_run_command (systemtap_session& s,
 
 std::map<std::string,std::string> make_tracequeries(systemtap_session& s, const std::map<std::string,std::string>& contents);
 int make_typequery(systemtap_session& s, std::string& module);
+void start_typequeries(systemtap_session& s, const std::vector<std::string>& modules);
+void finish_typequeries(systemtap_session& s);
 
 #endif // BUILDRUN_H
 
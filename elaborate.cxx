@@ -1264,6 +1264,32 @@ struct stat_decl_collector
     symbol *sym = get_symbol_within_expression (e->stat);
     if (session.stat_decls.find(sym->name) == session.stat_decls.end())
       session.stat_decls[sym->name] = statistic_decl();
+
+    statistic_decl & sd = session.stat_decls[sym->name];
+    switch (e->ctype)
+      {
+      case sc_sum:
+      case sc_average:
+        sd.stat_ops |= statistic_decl::op_sum;
+        break;
+      case sc_min:
+        sd.stat_ops |= statistic_decl::op_min;
+        break;
+      case sc_max:
+        sd.stat_ops |= statistic_decl::op_max;
+        break;
+      case sc_quantile:
+        {
+          // The estimate is clamped to the exact extremes.
+          sd.stat_ops |= statistic_decl::op_min | statistic_decl::op_max;
+          statistic_decl new_stat;
+          new_stat.type = statistic_decl::quantile;
+          declare_histogram (sym, new_stat, e->tok);
+        }
+        break;
+      default:
+        break;
+      }
   }
 
   void visit_assignment (assignment* e)
@@ -1298,6 +1324,12 @@ struct stat_decl_collector
 	assert (e->params.size() == 0);
       }
 
+    declare_histogram (sym, new_stat, e->tok);
+  }
+
+  void declare_histogram (symbol *sym, statistic_decl & new_stat,
+                          const token *tok)
+  {
     map<string, statistic_decl>::iterator i = session.stat_decls.find(sym->name);
     if (i == session.stat_decls.end())
       session.stat_decls[sym->name] = new_stat;
@@ -1307,11 +1339,14 @@ struct stat_decl_collector
 	if (!(old_stat == new_stat))
 	  {
 	    if (old_stat.type == statistic_decl::none)
-	      i->second = new_stat;
+	      {
+		new_stat.stat_ops = old_stat.stat_ops;
+		i->second = new_stat;
+	      }
 	    else
 	      {
 		// FIXME: Support multiple co-declared histogram types
-		semantic_error se(ERR_SRC, _F("multiple histogram types declared on '%s'", sym->name.c_str()), e->tok);
+		semantic_error se(ERR_SRC, _F("multiple histogram types declared on '%s'", sym->name.c_str()), tok);
 		session.print_error (se);
 	      }
 	  }
@@ -1560,6 +1595,117 @@ int gen_dfa_table (systemtap_session& s)
   return s.num_errors();
 }
 
+
+// Fuse the =~ tests of an if/else-if chain that match the same
+// variable against several regexes, so the string is scanned only
+// once. The first test runs the combined automaton and remembers
+// which regex matched first; the later tests just check that result.
+
+struct regex_fusing_visitor: public traversing_visitor
+{
+  systemtap_session& session;
+  set<if_statement*> chained;
+
+  regex_fusing_visitor (systemtap_session& s): session(s) { }
+
+  static regex_query* fusable_query (statement* st);
+  static statement* else_statement (if_statement* s);
+  void visit_if_statement (if_statement* s);
+};
+
+regex_query*
+regex_fusing_visitor::fusable_query (statement* st)
+{
+  if_statement* s = dynamic_cast<if_statement*>(st);
+  if (!s)
+    return NULL;
+  regex_query* q = dynamic_cast<regex_query*>(s->condition);
+  if (!q || q->op != "=~" || q->fused_index)
+    return NULL;
+  symbol* sym = dynamic_cast<symbol*>(q->left);
+  if (!sym || !sym->referent)
+    return NULL;
+  return q;
+}
+
+statement*
+regex_fusing_visitor::else_statement (if_statement* s)
+{
+  // NB: nothing may run between two tests of the chain.
+  block* b = dynamic_cast<block*>(s->elseblock);
+  if (b && b->statements.size() == 1)
+    return b->statements[0];
+  return s->elseblock;
+}
+
+void
+regex_fusing_visitor::visit_if_statement (if_statement* s)
+{
+  regex_query* q0 = fusable_query (s);
+  if (q0 && chained.insert(s).second)
+    {
+      vardecl* var = static_cast<symbol*>(q0->left)->referent;
+      vector<if_statement*> chain;
+      vector<regex_query*> queries;
+      vector<string> patterns;
+
+      statement* st = s;
+      for (regex_query* q = q0;
+           q && static_cast<symbol*>(q->left)->referent == var;
+           q = fusable_query (st))
+        {
+          if_statement* i = static_cast<if_statement*>(st);
+          chain.push_back (i);
+          queries.push_back (q);
+          patterns.push_back (q->right->value);
+          chained.insert (i);
+          st = else_statement (i);
+        }
+
+      stapdfa_set* dfa_set = NULL;
+      if (queries.size() > 1)
+        dfa_set = regex_set_to_stapdfa_set (&session, patterns, q0->tok);
+
+      if (dfa_set)
+        {
+          if (session.verbose > 2)
+            clog << _F("Fused %zu regex matches of '%s' into %s",
+                       queries.size(), var->name.c_str(),
+                       dfa_set->func_name.c_str()) << endl;
+          for (unsigned k = 0; k < queries.size(); k++)
+            {
+              queries[k]->fused_set = dfa_set->func_name;
+              queries[k]->fused_index = k + 1;
+              queries[k]->fused_first = (k == 0);
+            }
+        }
+    }
+
+  traversing_visitor::visit_if_statement (s);
+}
+
+void fuse_regex_matches (systemtap_session& s)
+{
+  // Subexpression extraction needs each match's own tagged DFA.
+  if (s.unoptimized || s.need_tagged_dfa)
+    return;
+
+  regex_fusing_visitor rfv(s);
+
+  for (unsigned i=0; i<s.probes.size(); i++)
+    {
+      assert_no_interrupts();
+      s.probes[i]->body->visit (& rfv);
+    }
+
+  for (map<string,functiondecl*>::iterator it = s.functions.begin();
+       it != s.functions.end(); it++)
+    {
+      assert_no_interrupts();
+      it->second->body->visit (& rfv);
+    }
+}
+
 // ------------------------------------------------------------------------
 
 
@@ -1631,6 +1777,9 @@ semantic_pass_symbols (systemtap_session& s)
       // Pass 2: derive probes and resolve any further symbols in the
       // derived results.
 
+      // Any typequeries for @cast can build in the meantime.
+      start_cast_typequeries (s, dome);
+
       for (unsigned i=0; i<dome->probes.size(); i++)
         {
           assert_no_interrupts();
@@ -1998,6 +2147,7 @@ semantic_pass (systemtap_session& s)
       if (rc == 0) rc = semantic_pass_optimize2 (s);
       if (rc == 0) rc = semantic_pass_vars (s);
       if (rc == 0) rc = semantic_pass_stats (s);
+      if (rc == 0) fuse_regex_matches (s);
       if (rc == 0) embeddedcode_info_pass (s);
 
       if (s.num_errors() == 0 && s.probes.size() == 0 && !s.listing_mode)
@@ -2363,22 +2513,224 @@ symresolution_info::collect_functions(void)
 // optimization
 
 
+// The passes below are repeated in a relaxation loop until none of
+// them finds anything more to remove.  To keep the later iterations
+// cheap for scripts with many probes, optimize_worklist tracks which
+// probe and function bodies were rewritten, so that only those (and
+// the callers of rewritten functions) are visited again.  The variable
+// use of each body is cached, so the program-wide read/written sets
+// can be rebuilt without walking unchanged bodies either.
+
+// The variable use of a single probe or function body.
+struct body_varuse
+{
+  set<vardecl*> read;
+  set<vardecl*> written;
+  set<functiondecl*> callees;
+};
+
+// A varuse_collecting_visitor that doesn't follow function calls, but
+// just notes the callees; they get their own body_varuse.
+struct body_varuse_visitor: public varuse_collecting_visitor
+{
+  set<functiondecl*> callees;
+
+  body_varuse_visitor(systemtap_session& s): varuse_collecting_visitor(s) {}
+
+  void visit_functioncall (functioncall* e)
+  {
+    traversing_visitor::visit_functioncall (e);
+    callees.insert (e->referent);
+  }
+};
+
+struct optimize_worklist
+{
+  systemtap_session& session;
+  bool first; // first iteration: visit everything
+
+  // Bodies to visit in this iteration.
+  set<derived_probe*> probes;
+  set<functiondecl*> functions;
+
+  // Bodies rewritten in this iteration.
+  set<derived_probe*> changed_probes;
+  set<functiondecl*> changed_functions;
+
+  // Cached variable use, dropped when the body is rewritten.
+  map<derived_probe*, body_varuse> probe_uses;
+  map<functiondecl*, body_varuse> function_uses;
+
+  // Variables read/written by the probes and reachable functions,
+  // as of the last semantic_pass_opt1.
+  set<vardecl*> read;
+  set<vardecl*> written;
+
+  // Probes sharing the body of an identical earlier probe, which is
+  // the one the passes work on; see share_probe_bodies().
+  map<derived_probe*, derived_probe*> shared;
+
+  optimize_worklist(systemtap_session& s): session(s), first(true) {}
+
+  bool wants (derived_probe* p) const
+  {
+    return (first || probes.count (p)) && ! shared.count (p);
+  }
+  bool wants (functiondecl* fd) const { return first || functions.count (fd); }
+
+  void changed (derived_probe* p)
+  {
+    changed_probes.insert (p);
+    probe_uses.erase (p);
+  }
+  void changed (functiondecl* fd)
+  {
+    changed_functions.insert (fd);
+    function_uses.erase (fd);
+  }
+
+  // Account for a pass having been run over a body, with its visitor
+  // reporting into body_relaxed_p.
+  template <class T>
+  void update (T* x, bool& body_relaxed_p, bool& relaxed_p)
+  {
+    if (! body_relaxed_p)
+      {
+        changed (x);
+        relaxed_p = false;
+        body_relaxed_p = true;
+      }
+  }
+
+  const body_varuse& uses (derived_probe* p);
+  const body_varuse& uses (functiondecl* fd);
+
+  // Merge u into read/written, queueing its callees not yet traversed.
+  void add_uses (const body_varuse& u, set<functiondecl*>& traversed,
+                 vector<functiondecl*>& todo)
+  {
+    read.insert (u.read.begin(), u.read.end());
+    written.insert (u.written.begin(), u.written.end());
+    for (set<functiondecl*>::const_iterator c = u.callees.begin();
+         c != u.callees.end(); c++)
+      if (traversed.insert (*c).second)
+        todo.push_back (*c);
+  }
+  void next_iteration (bool with_callers);
+};
+
+
+const body_varuse&
+optimize_worklist::uses (derived_probe* p)
+{
+  map<derived_probe*, body_varuse>::iterator it = probe_uses.find (p);
+  if (it != probe_uses.end())
+    return it->second;
+
+  body_varuse_visitor vut (session);
+  p->body->visit (& vut);
+  if (p->sole_location()->condition)
+    p->sole_location()->condition->visit (& vut);
+
+  body_varuse& u = probe_uses[p];
+  u.read.swap (vut.read);
+  u.written.swap (vut.written);
+  u.callees.swap (vut.callees);
+  return u;
+}
+
+
+const body_varuse&
+optimize_worklist::uses (functiondecl* fd)
+{
+  map<functiondecl*, body_varuse>::iterator it = function_uses.find (fd);
+  if (it != function_uses.end())
+    return it->second;
+
+  body_varuse_visitor vut (session);
+  vut.current_function = fd;
+  fd->body->visit (& vut);
+
+  body_varuse& u = function_uses[fd];
+  u.read.swap (vut.read);
+  u.written.swap (vut.written);
+  u.callees.swap (vut.callees);
+  return u;
+}
+
+
+void
+optimize_worklist::next_iteration (bool with_callers)
+{
+  first = false;
+  probes.swap (changed_probes);
+  functions.swap (changed_functions);
+  changed_probes.clear ();
+  changed_functions.clear ();
+
+  // A rewritten function may have lost its side-effects, which can
+  // make calls to it removable by opt4/opt5, so its callers have to
+  // be revisited too, transitively.  (Rewritten callers have no
+  // cached use, but they are already queued themselves.)
+  if (! with_callers || functions.empty())
+    return;
+
+  map<functiondecl*, vector<derived_probe*> > probe_callers;
+  map<functiondecl*, vector<functiondecl*> > function_callers;
+  for (map<derived_probe*, body_varuse>::iterator it = probe_uses.begin();
+       it != probe_uses.end(); it++)
+    for (set<functiondecl*>::iterator c = it->second.callees.begin();
+         c != it->second.callees.end(); c++)
+      probe_callers[*c].push_back (it->first);
+  for (map<functiondecl*, body_varuse>::iterator it = function_uses.begin();
+       it != function_uses.end(); it++)
+    for (set<functiondecl*>::iterator c = it->second.callees.begin();
+         c != it->second.callees.end(); c++)
+      function_callers[*c].push_back (it->first);
+
+  vector<functiondecl*> todo (functions.begin(), functions.end());
+  while (! todo.empty())
+    {
+      functiondecl* fd = todo.back();
+      todo.pop_back();
+
+      vector<derived_probe*>& pc = probe_callers[fd];
+      probes.insert (pc.begin(), pc.end());
+
+      vector<functiondecl*>& fc = function_callers[fd];
+      for (unsigned i=0; i<fc.size(); i++)
+        if (functions.insert (fc[i]).second)
+          todo.push_back (fc[i]);
+    }
+}
+
+
 // Do away with functiondecls that are never (transitively) called
-// from probes.
-void semantic_pass_opt1 (systemtap_session& s, bool& relaxed_p)
+// from probes.  While walking the call graph, this also gathers the
+// variable use of everything reachable for opt2 and opt3.
+void semantic_pass_opt1 (systemtap_session& s, bool& relaxed_p,
+                         optimize_worklist& wl)
 {
-  functioncall_traversing_visitor ftv;
+  set<functiondecl*> traversed;
+  vector<functiondecl*> todo;
+  wl.read.clear ();
+  wl.written.clear ();
+
   for (unsigned i=0; i<s.probes.size(); i++)
+    if (! wl.shared.count (s.probes[i]))
+      wl.add_uses (wl.uses (s.probes[i]), traversed, todo);
+  while (! todo.empty())
     {
-      s.probes[i]->body->visit (& ftv);
-      if (s.probes[i]->sole_location()->condition)
-        s.probes[i]->sole_location()->condition->visit (& ftv);
+      functiondecl* fd = todo.back();
+      todo.pop_back();
+      wl.add_uses (wl.uses (fd), traversed, todo);
     }
+
   vector<functiondecl*> new_unused_functions;
   for (map<string,functiondecl*>::iterator it = s.functions.begin(); it != s.functions.end(); it++)
     {
       functiondecl* fd = it->second;
-      if (ftv.traversed.find(fd) == ftv.traversed.end())
+      if (traversed.find(fd) == traversed.end())
         {
           if (fd->tok->location.file->name == s.user_file->name && ! fd->synthetic)// !tapset
             s.print_warning (_F("Eliding unused function '%s'", fd->name.c_str()), fd->tok);
@@ -2392,6 +2744,7 @@ void semantic_pass_opt1 (systemtap_session& s, bool& relaxed_p)
       map<string,functiondecl*>::iterator where = s.functions.find (new_unused_functions[i]->name);
       assert (where != s.functions.end());
       s.functions.erase (where);
+      wl.function_uses.erase (new_unused_functions[i]);
       if (s.tapset_compile_coverage)
         s.unused_functions.push_back (new_unused_functions[i]);
     }
@@ -2402,38 +2755,26 @@ void semantic_pass_opt1 (systemtap_session& s, bool& relaxed_p)
 
 // Do away with local & global variables that are never
 // written nor read.
-void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterations)
+void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterations,
+                         optimize_worklist& wl)
 {
-  varuse_collecting_visitor vut(s);
+  // The read/written sets were collected by opt1, from the probes and
+  // the functions they (transitively) call.  Uncalled functions were
+  // pruned there as well.  Locals can only become unused when their
+  // own body was rewritten, so only those need to be checked again.
+  const set<vardecl*>& read = wl.read;
+  const set<vardecl*>& written = wl.written;
 
   for (unsigned i=0; i<s.probes.size(); i++)
-    {
-      s.probes[i]->body->visit (& vut);
-
-      if (s.probes[i]->sole_location()->condition)
-        s.probes[i]->sole_location()->condition->visit (& vut);
-    }
-
-  // NB: Since varuse_collecting_visitor also traverses down
-  // actually called functions, we don't need to explicitly
-  // iterate over them.  Uncalled ones should have been pruned
-  // in _opt1 above.
-  //
-  // for (unsigned i=0; i<s.functions.size(); i++)
-  //   s.functions[i]->body->visit (& vut);
-
-  // Now in vut.read/written, we have a mixture of all locals, globals
-
-  for (unsigned i=0; i<s.probes.size(); i++)
-    for (unsigned j=0; j<s.probes[i]->locals.size(); /* see below */)
+    for (unsigned j=0; wl.wants (s.probes[i]) && j<s.probes[i]->locals.size(); /* see below */)
       {
         vardecl* l = s.probes[i]->locals[j];
 
         // skip over "special" locals
         if (l->synthetic) { j++; continue; }
 
-        if (vut.read.find (l) == vut.read.end() &&
-            vut.written.find (l) == vut.written.end())
+        if (read.find (l) == read.end() &&
+            written.find (l) == written.end())
           {
             if (l->tok->location.file->name == s.user_file->name) // !tapset
               s.print_warning (_F("Eliding unused variable '%s'", l->name.c_str()), l->tok);
@@ -2447,7 +2788,7 @@ void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterati
           }
         else
           {
-            if (vut.written.find (l) == vut.written.end())
+            if (written.find (l) == written.end())
               if (iterations == 0 && ! s.suppress_warnings)
                 {
                   set<string> vars;
@@ -2470,11 +2811,13 @@ void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterati
   for (map<string,functiondecl*>::iterator it = s.functions.begin(); it != s.functions.end(); it++)
     {
       functiondecl *fd = it->second;
+      if (! wl.wants (fd))
+        continue;
       for (unsigned j=0; j<fd->locals.size(); /* see below */)
         {
           vardecl* l = fd->locals[j];
-          if (vut.read.find (l) == vut.read.end() &&
-              vut.written.find (l) == vut.written.end())
+          if (read.find (l) == read.end() &&
+              written.find (l) == written.end())
             {
               if (l->tok->location.file->name == s.user_file->name) // !tapset
                 s.print_warning (_F("Eliding unused variable '%s'", l->name.c_str()), l->tok);
@@ -2487,7 +2830,7 @@ void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterati
             }
           else
             {
-              if (vut.written.find (l) == vut.written.end())
+              if (written.find (l) == written.end())
                 if (iterations == 0 && ! s.suppress_warnings)
                   {
                     set<string> vars;
@@ -2514,8 +2857,8 @@ void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterati
   for (unsigned i=0; i<s.globals.size(); /* see below */)
     {
       vardecl* l = s.globals[i];
-      if (vut.read.find (l) == vut.read.end() &&
-          vut.written.find (l) == vut.written.end())
+      if (read.find (l) == read.end() &&
+          written.find (l) == written.end())
         {
           if (l->tok->location.file->name == s.user_file->name) // !tapset
             s.print_warning (_F("Eliding unused variable '%s'", l->name.c_str()), l->tok);
@@ -2528,7 +2871,7 @@ void semantic_pass_opt2 (systemtap_session& s, bool& relaxed_p, unsigned iterati
         }
       else
         {
-          if (vut.written.find (l) == vut.written.end() && ! l->init) // no initializer
+          if (written.find (l) == written.end() && ! l->init) // no initializer
             if (iterations == 0 && ! s.suppress_warnings)
               {
                 set<string> vars;
@@ -2555,11 +2898,11 @@ struct dead_assignment_remover: public update_visitor
 {
   systemtap_session& session;
   bool& relaxed_p;
-  const varuse_collecting_visitor& vut;
+  const set<vardecl*>& read;
 
   dead_assignment_remover(systemtap_session& s, bool& r,
-                          const varuse_collecting_visitor& v):
-    session(s), relaxed_p(r), vut(v) {}
+                          const set<vardecl*>& v):
+    session(s), relaxed_p(r), read(v) {}
 
   void visit_assignment (assignment* e);
   void visit_try_block (try_block *s);
@@ -2576,7 +2919,7 @@ dead_assignment_remover::visit_assignment (assignment* e)
   vardecl* leftvar = left->referent; // NB: may be 0 for unresolved $target
   if (leftvar) // not unresolved $target, so intended sideeffect may be elided
     {
-      if (vut.read.find(leftvar) == vut.read.end()) // var never read?
+      if (read.find(leftvar) == read.end()) // var never read?
         {
           // NB: Not so fast!  The left side could be an array whose
           // index expressions may have side-effects.  This would be
@@ -2625,7 +2968,7 @@ dead_assignment_remover::visit_try_block (try_block *s)
   if (s->catch_error_var)
     {
       vardecl* errvar = s->catch_error_var->referent;
-      if (vut.read.find(errvar) == vut.read.end()) // never read?
+      if (read.find(errvar) == read.end()) // never read?
         {
           if (session.verbose>2)
             clog << _F("Eliding unused error string catcher %s at %s",
@@ -2642,23 +2985,31 @@ dead_assignment_remover::visit_try_block (try_block *s)
 // rewrite "(foo = expr)" as "(expr)".  This makes foo a candidate to
 // be optimized away as an unused variable, and expr a candidate to be
 // removed as a side-effect-free statement expression.  Wahoo!
-void semantic_pass_opt3 (systemtap_session& s, bool& relaxed_p)
-{
-  // Recompute the varuse data, which will probably match the opt2
-  // copy of the computation, except for those totally unused
-  // variables that opt2 removed.
-  varuse_collecting_visitor vut(s);
-  for (unsigned i=0; i<s.probes.size(); i++)
-    s.probes[i]->body->visit (& vut); // includes reachable functions too
-
-  dead_assignment_remover dar (s, relaxed_p, vut);
+void semantic_pass_opt3 (systemtap_session& s, bool& relaxed_p,
+                         optimize_worklist& wl)
+{
+  // Use the varuse data collected by opt1, which will probably match
+  // the opt2 view, except for those totally unused variables that opt2
+  // removed.  Only globals are read across bodies, and assignments to
+  // those are never elided here, so only rewritten bodies can turn up
+  // anything new.
+  bool body_relaxed_p = true;
+  dead_assignment_remover dar (s, body_relaxed_p, wl.read);
   // This instance may be reused for multiple probe/function body trims.
 
   for (unsigned i=0; i<s.probes.size(); i++)
-    dar.replace (s.probes[i]->body);
+    if (wl.wants (s.probes[i]))
+      {
+        dar.replace (s.probes[i]->body);
+        wl.update (s.probes[i], body_relaxed_p, relaxed_p);
+      }
   for (map<string,functiondecl*>::iterator it = s.functions.begin();
        it != s.functions.end(); it++)
-    dar.replace (it->second->body);
+    if (wl.wants (it->second))
+      {
+        dar.replace (it->second->body);
+        wl.update (it->second, body_relaxed_p, relaxed_p);
+      }
   // The rewrite operation is performed within the visitor.
 
   // XXX: we could also zap write-only globals here
@@ -2893,13 +3244,15 @@ dead_stmtexpr_remover::visit_expr_statement (expr_statement *s)
 }
 
 
-void semantic_pass_opt4 (systemtap_session& s, bool& relaxed_p)
+void semantic_pass_opt4 (systemtap_session& s, bool& relaxed_p,
+                         optimize_worklist& wl)
 {
   // Finally, let's remove some statement-expressions that have no
   // side-effect.  These should be exactly those whose private varuse
   // visitors come back with an empty "written" and "embedded" lists.
 
-  dead_stmtexpr_remover duv (s, relaxed_p);
+  bool body_relaxed_p = true;
+  dead_stmtexpr_remover duv (s, body_relaxed_p);
   // This instance may be reused for multiple probe/function body trims.
 
   for (unsigned i=0; i<s.probes.size(); i++)
@@ -2907,6 +3260,8 @@ void semantic_pass_opt4 (systemtap_session& s, bool& relaxed_p)
       assert_no_interrupts();
 
       derived_probe* p = s.probes[i];
+      if (! wl.wants (p))
+        continue;
 
       duv.focal_vars.clear ();
       duv.focal_vars.insert (s.globals.begin(),
@@ -2924,12 +3279,16 @@ void semantic_pass_opt4 (systemtap_session& s, bool& relaxed_p)
 
           // XXX: possible duplicate warnings; see below
         }
+      wl.update (p, body_relaxed_p, relaxed_p);
     }
   for (map<string,functiondecl*>::iterator it = s.functions.begin(); it != s.functions.end(); it++)
     {
       assert_no_interrupts();
 
       functiondecl* fn = it->second;
+      if (! wl.wants (fn))
+        continue;
+
       duv.focal_vars.clear ();
       duv.focal_vars.insert (fn->locals.begin(),
                              fn->locals.end());
@@ -2951,6 +3310,7 @@ void semantic_pass_opt4 (systemtap_session& s, bool& relaxed_p)
           // only after the relaxation iterations.
           // XXX: or else see bug #6469.
         }
+      wl.update (fn, body_relaxed_p, relaxed_p);
     }
 }
 
@@ -3386,20 +3746,30 @@ void_statement_reducer::visit_defined_op (defined_op* e)
 
 
 
-void semantic_pass_opt5 (systemtap_session& s, bool& relaxed_p)
+void semantic_pass_opt5 (systemtap_session& s, bool& relaxed_p,
+                         optimize_worklist& wl)
 {
   // Let's simplify statements with unused computed values.
 
-  void_statement_reducer vuv (s, relaxed_p);
+  bool body_relaxed_p = true;
+  void_statement_reducer vuv (s, body_relaxed_p);
   // This instance may be reused for multiple probe/function body trims.
 
   vuv.focal_vars.insert (s.globals.begin(), s.globals.end());
 
   for (unsigned i=0; i<s.probes.size(); i++)
-    vuv.replace (s.probes[i]->body);
+    if (wl.wants (s.probes[i]))
+      {
+        vuv.replace (s.probes[i]->body);
+        wl.update (s.probes[i], body_relaxed_p, relaxed_p);
+      }
   for (map<string,functiondecl*>::iterator it = s.functions.begin();
        it != s.functions.end(); it++)
-    vuv.replace (it->second->body);
+    if (wl.wants (it->second))
+      {
+        vuv.replace (it->second->body);
+        wl.update (it->second, body_relaxed_p, relaxed_p);
+      }
 }
 
 
@@ -3932,18 +4302,28 @@ const_folder::visit_target_symbol (target_symbol* e)
     update_visitor::visit_target_symbol (e);
 }
 
-static void semantic_pass_const_fold (systemtap_session& s, bool& relaxed_p)
+static void semantic_pass_const_fold (systemtap_session& s, bool& relaxed_p,
+                                      optimize_worklist& wl)
 {
   // Let's simplify statements with constant values.
 
-  const_folder cf (s, relaxed_p);
+  bool body_relaxed_p = true;
+  const_folder cf (s, body_relaxed_p);
   // This instance may be reused for multiple probe/function body trims.
 
   for (unsigned i=0; i<s.probes.size(); i++)
-    cf.replace (s.probes[i]->body);
+    if (wl.wants (s.probes[i]))
+      {
+        cf.replace (s.probes[i]->body);
+        wl.update (s.probes[i], body_relaxed_p, relaxed_p);
+      }
   for (map<string,functiondecl*>::iterator it = s.functions.begin();
        it != s.functions.end(); it++)
-    cf.replace (it->second->body);
+    if (wl.wants (it->second))
+      {
+        cf.replace (it->second->body);
+        wl.update (it->second, body_relaxed_p, relaxed_p);
+      }
 }
 
 
@@ -4045,6 +4425,43 @@ void semantic_pass_opt6 (systemtap_session& s, bool& relaxed_p)
 }
 
 
+// Wildcard probe points tend to derive thousands of probes with the
+// very same handler, e.g. kernel.function("*") { counts[ppfunc()]++ }.
+// Rather than optimizing (and type checking and hashing) each copy,
+// let probes whose bodies print identically share the body and locals
+// of the first one.  The dupe stamp goes into the key too, as in
+// c_unparser::emit_probe, so that probes that would be emitted
+// differently keep their own copy.
+static void
+share_probe_bodies (systemtap_session& s, optimize_worklist& wl)
+{
+  map<string, derived_probe*> bodies;
+
+  for (unsigned i=0; i<s.probes.size(); i++)
+    {
+      assert_no_interrupts();
+
+      derived_probe* p = s.probes[i];
+      ostringstream oss;
+      p->print_dupe_stamp (oss);
+      p->body->print (oss);
+
+      derived_probe*& first = bodies[oss.str()];
+      if (first == 0)
+        first = p;
+      else
+        {
+          if (s.verbose > 2)
+            clog << _F("%s shares the handler body of %s",
+                       p->name.c_str(), first->name.c_str()) << endl;
+          p->body = first->body;
+          p->locals = first->locals;
+          wl.shared[p] = first;
+        }
+    }
+}
+
+
 static int
 semantic_pass_optimize1 (systemtap_session& s)
 {
@@ -4052,7 +4469,9 @@ semantic_pass_optimize1 (systemtap_session& s)
   // eliminate some blatantly unnecessary code.  This is run before
   // type inference, but after symbol resolution and derived_probe
   // creation.  We run an outer "relaxation" loop that repeats the
-  // optimizations until none of them find anything to remove.
+  // optimizations until none of them find anything to remove.  After
+  // the first iteration, only the bodies that were rewritten (and
+  // their callers) are revisited.
 
   int rc = 0;
 
@@ -4060,6 +4479,9 @@ semantic_pass_optimize1 (systemtap_session& s)
   // it below.
   save_and_restore<bool> suppress_warnings(& s.suppress_warnings);
 
+  optimize_worklist wl (s);
+  share_probe_bodies (s, wl);
+
   bool relaxed_p = false;
   unsigned iterations = 0;
   while (! relaxed_p)
@@ -4077,22 +4499,34 @@ semantic_pass_optimize1 (systemtap_session& s)
 
       if (!s.unoptimized)
         {
-          semantic_pass_opt1 (s, relaxed_p);
-          semantic_pass_opt2 (s, relaxed_p, iterations); // produce some warnings only on iteration=0
-          semantic_pass_opt3 (s, relaxed_p);
-          semantic_pass_opt4 (s, relaxed_p);
-          semantic_pass_opt5 (s, relaxed_p);
+          semantic_pass_opt1 (s, relaxed_p, wl);
+          semantic_pass_opt2 (s, relaxed_p, iterations, wl); // produce some warnings only on iteration=0
+          semantic_pass_opt3 (s, relaxed_p, wl);
+          semantic_pass_opt4 (s, relaxed_p, wl);
+          semantic_pass_opt5 (s, relaxed_p, wl);
         }
 
       // For listing mode, we need const-folding regardless of optimization so
       // that @defined expressions can be properly resolved.  PR11360
       // We also want it in case variables are used in if/case expressions,
       // so enable always.  PR11366
-      semantic_pass_const_fold (s, relaxed_p);
+      semantic_pass_const_fold (s, relaxed_p, wl);
 
+      // Const-folding only looks at the body it rewrites, but opt4 and
+      // opt5 also care about the side-effects of called functions.
+      wl.next_iteration (! s.unoptimized);
       iterations ++;
     }
 
+  // The passes may have replaced or trimmed the shared bodies and
+  // locals; point the sharing probes at the final version.
+  for (map<derived_probe*, derived_probe*>::iterator it = wl.shared.begin();
+       it != wl.shared.end(); it++)
+    {
+      it->first->body = it->second->body;
+      it->first->locals = it->second->locals;
+    }
+
   return rc;
 }
 
@@ -4178,17 +4612,23 @@ semantic_pass_types (systemtap_session& s)
             ti.check_local (fd->locals[i]);
         }
 
+      // Probes may share their body (see share_probe_bodies), which
+      // only needs to be resolved once.
+      set<statement*> visited_bodies;
       for (unsigned j=0; j<s.probes.size(); j++)
         {
           assert_no_interrupts();
 
           derived_probe* pn = s.probes[j];
-          ti.current_function = 0;
-          ti.current_probe = pn;
-          ti.t = pe_unknown;
-          pn->body->visit (& ti);
-          for (unsigned i=0; i < pn->locals.size(); ++i)
-            ti.check_local (pn->locals[i]);
+          if (visited_bodies.insert (pn->body).second)
+            {
+              ti.current_function = 0;
+              ti.current_probe = pn;
+              ti.t = pe_unknown;
+              pn->body->visit (& ti);
+              for (unsigned i=0; i < pn->locals.size(); ++i)
+                ti.check_local (pn->locals[i]);
+            }
 
           probe_point* pp = pn->sole_location();
           if (pp->condition)
@@ -18,6 +18,7 @@
 #include "session.h"
 #include "hash.h"
 #include "util.h"
+#include "setupdwfl.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -385,4 +386,65 @@ find_uprobes_hash (systemtap_session& s)
   return hashdir + "/uprobes_" + result;
 }
 
+
+// The system-wide cache of tracequery and typequery modules lives in
+// $localstatedir/cache/systemtap/query/<kernel build-id>.  Root fills it
+// as a side effect of building these modules (e.g. run by stap-prep
+// once per kernel package), and every other user and compile server
+// then uses the prebuilt modules in place.  The modules keep the names
+// of the per-user cache, whose hashes don't depend on the user.
+static const string&
+get_system_cache_path (systemtap_session& s)
+{
+  if (s.system_cache_path.empty())
+    {
+      string key = get_kernel_build_id (s);
+      if (key.empty())
+        key = s.kernel_release;
+      s.system_cache_path = string(LOCALSTATEDIR) + "/cache/" PACKAGE
+        + "/query/" + key;
+    }
+  return s.system_cache_path;
+}
+
+
+// Return the system cache counterpart of the given per-user cache file,
+// or "" if there is none.  Only files that only root can write to, in a
+// directory that only root can write to, are trusted.
+string
+find_system_cache_file (systemtap_session& s, const string& cache_file)
+{
+  if (cache_file.empty() || !s.use_cache || s.poison_cache)
+    return "";
+
+  const string& dir = get_system_cache_path (s);
+  struct stat st;
+  if (stat (dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)
+      || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    return "";
+
+  string path = dir + "/" + cache_file.substr(cache_file.rfind('/') + 1);
+  if (stat (path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)
+      || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    return "";
+  return path;
+}
+
+
+// When running as root, also copy a newly cached module into the system
+// cache, creating its directories (root-owned, 0755) as needed.
+void
+update_system_cache (systemtap_session& s, const string& cache_file)
+{
+  if (cache_file.empty() || getuid() != 0)
+    return;
+
+  const string& dir = get_system_cache_path (s);
+  if (create_dir (dir.c_str(), 0755) != 0)
+    return;
+
+  string path = dir + "/" + cache_file.substr(cache_file.rfind('/') + 1);
+  copy_file (cache_file, path, s.verbose > 2);
+}
+
 /* vim: set sw=2 ts=8 cino=>4,n-2,{2,^-2,t0,(0,u0,w1,M1 : */
@@ -10,5 +10,8 @@ std::string find_tracequery_hash (systemtap_session& s,
                                   const std::string& header);
 std::string find_typequery_hash (systemtap_session& s, const std::string& name);
 std::string find_uprobes_hash (systemtap_session& s);
+std::string find_system_cache_file (systemtap_session& s,
+                                    const std::string& cache_file);
+void update_system_cache (systemtap_session& s, const std::string& cache_file);
 
 /* vim: set sw=2 ts=8 cino=>4,n-2,{2,^-2,t0,(0,u0,w1,M1 : */
@@ -81,6 +81,8 @@ struct location
       char *program;		/* C fragment, leaves address in s0.  */
       unsigned int stack_depth;	/* Temporaries "s0..<N>" used by it.  */
       bool used_deref;		/* Program uses "deref" macro.  */
+      bool offset_only;		/* Program is just "addr += offset".  */
+      Dwarf_Sword offset;
     } address;
     struct			/* loc_register */
     {
@@ -169,6 +171,7 @@ translate_constant (struct location_context *ctx, int indent,
   loc->address.stack_depth = 0;
   loc->address.declare = NULL;
   loc->address.used_deref = false;
+  loc->address.offset_only = false;
   loc->ops = NULL;
   loc->nops = 0;
 
@@ -282,6 +285,7 @@ new_synthetic_loc (struct location *origin, bool deref)
   loc->address.stack_depth = 0;
   loc->address.declare = NULL;
   loc->address.used_deref = deref;
+  loc->address.offset_only = false;
 
   if (origin->type == loc_register)
     {
@@ -459,6 +463,7 @@ translate (struct location_context *ctx, int indent,
 	      piece->address.program = program;
 	      piece->address.stack_depth = max_stack;
 	      piece->address.used_deref = used_deref;
+	      piece->address.offset_only = false;
 	    }
 	  else
 	    {
@@ -890,12 +895,54 @@ translate (struct location_context *ctx, int indent,
 #undef DIE
 }
 
+/* Translate a constant OFFSET from the *INPUT address, as for the
+   DW_AT_data_member_location of most struct members.  This needs none
+   of the DWARF stack machinery: the offset becomes a bare "addr += N"
+   fragment, or is folded into the preceding one if that is an offset
+   too, so a chain like $a->b.c->d comes out as a flat sequence of
+   loads and additions.  */
+static struct location *
+location_offset_from_address (struct location_context *ctx, int indent,
+			      Dwarf_Sword offset, struct location **input)
+{
+  struct location *loc = *input;
+
+  if (loc->address.offset_only)
+    offset += loc->address.offset;
+  else if (offset == 0)
+    return loc;
+
+  obstack_printf (ctx->pool, "%*saddr += " SFORMAT ";\n",
+		  indent * 2, "", offset);
+
+  if (loc->address.offset_only)
+    {
+      obstack_1grow (ctx->pool, '\0');
+      loc->address.program = obstack_finish (ctx->pool);
+    }
+  else
+    {
+      loc = new_synthetic_loc (*input, false);
+      loc->address.offset_only = true;
+      (*input)->next = loc;
+      *input = loc;
+    }
+  loc->address.offset = offset;
+
+  return loc;
+}
+
 /* Translate a location starting from an address or nothing.  */
 static struct location *
 location_from_address (struct location_context *ctx, int indent,
 		       const Dwarf_Op *expr, size_t len,
 		       struct location **input)
 {
+  if (*input != NULL && (*input)->type == loc_address
+      && len == 1 && expr[0].atom == DW_OP_plus_uconst)
+    return location_offset_from_address (ctx, indent,
+					 expr[0].number, input);
+
   struct location *loc = obstack_alloc (ctx->pool, sizeof *loc);
   loc->context = ctx;
   loc->byte_size = 0;
@@ -1045,9 +1092,11 @@ translate_offset (int indent, const Dwarf_Op *expr, size_t len, size_t i,
 	else
 	  {
 	    /* Add a second fragment to offset the piece address.  */
-	    obstack_printf (ctx->pool, "%*saddr += " SFORMAT "\n",
+	    obstack_printf (ctx->pool, "%*saddr += " SFORMAT ";\n",
 			    indent * 2, "", offset);
 	    *input = loc->next = new_synthetic_loc (*input, false);
+	    (*input)->address.offset_only = true;
+	    (*input)->address.offset = offset;
 	  }
 
 	/* That's all she wrote.  */
@@ -1496,6 +1545,7 @@ c_translate_argument (struct obstack *pool,
   loc->address.program = program;
   loc->address.stack_depth = 0;
   loc->address.used_deref = false;
+  loc->address.offset_only = false;
 
   return loc;
 }
@@ -2508,6 +2558,14 @@ emit_loc_value (FILE *out, struct location *loc, unsigned int indent,
   emit ("%*s}\n", --indent * 2, "");
 }
 
+/* Is LOC an address fragment that needs no stack slots of its own?  */
+static bool
+synthetic_address_p (struct location *loc)
+{
+  return (loc->type == loc_address && loc->ops == NULL
+	  && loc->address.stack_depth == 0);
+}
+
 bool
 c_emit_location (FILE *out, struct location *loc, int indent,
 		 unsigned int *max_stack)
@@ -2560,6 +2618,23 @@ c_emit_location (FILE *out, struct location *loc, int indent,
     switch (loc->type)
       {
       case loc_address:
+	if (synthetic_address_p (loc) && synthetic_address_p (loc->next))
+	  {
+	    /* A run of synthesized fragments, like the pointer loads and
+	       member offsets of a $a->b->c chain, shares one block.  */
+	    emit_header (out, loc, indent + 1);
+	    for (;;)
+	      {
+		emit ("%s", loc->address.program);
+		deref = deref || loc->address.used_deref;
+		if (!synthetic_address_p (loc->next))
+		  break;
+		loc = loc->next;
+	      }
+	    emit ("%*s}\n", (indent + 1) * 2, "");
+	    break;
+	  }
+	/* Fall through.  */
       case loc_value:
 	/* Emit the program fragment to calculate the address.  */
 	emit_loc_value (out, loc, indent + 1, "addr", false, &deref, max_stack);
@@ -21,7 +21,8 @@ struct location;		/* Opaque */
 
    On success, return the first fragment created, which is also chained
    onto (*INPUT)->next.  *INPUT is then updated with the new tail of that
-   chain.  */
+   chain.  A constant offset from an *INPUT address may instead be folded
+   into *INPUT itself, which is then returned.  */
 struct location *c_translate_location (struct obstack *,
 				       void (*fail) (void *arg,
 						     const char *fmt, ...)
@@ -1366,6 +1366,8 @@ lexer::lexer (istream& input, const string& in, systemtap_session& s):
       atwords.insert("@sum");
       atwords.insert("@min");
       atwords.insert("@max");
+      atwords.insert("@quantile");
+      atwords.insert("@percentile");
       atwords.insert("@hist_linear");
       atwords.insert("@hist_log");
     }
@@ -3390,11 +3392,30 @@ expression* parser::parse_symbol ()
 	    sop->ctype = sc_min;
 	  else if (name == "@max")
 	    sop->ctype = sc_max;
+	  else if (name == "@quantile" || name == "@percentile")
+	    sop->ctype = sc_quantile;
 	  else
 	    throw PARSE_ERROR(_("unknown operator ") + name);
 	  expect_op("(");
 	  sop->tok = t;
 	  sop->stat = parse_expression ();
+	  if (sop->ctype == sc_quantile)
+	    {
+	      // @quantile(s, num, den) or @percentile(s, pct)
+	      int64_t num, den = 100;
+	      expect_op (",");
+	      const token* nt = peek ();
+	      expect_number (num);
+	      if (name == "@quantile")
+		{
+		  expect_op (",");
+		  expect_number (den);
+		}
+	      if (den < 1 || den > 0xffffffffLL || num < 0 || num > den)
+		throw PARSE_ERROR (_("quantile must be a fraction between 0 and 1"), nt);
+	      sop->params.push_back (num);
+	      sop->params.push_back (den);
+	    }
 	  expect_op(")");
 	  return sop;
 	}
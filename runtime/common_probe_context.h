@@ -10,8 +10,8 @@ int data_index;
 /* The index of the active probe within stap_probes[].  */
 size_t probe_index;
 
-/* The lock for this context structure. */
-pthread_mutex_t lock;
+/* Nonzero while a thread has claimed this context structure. */
+atomic_t claimed;
 
 /* The transport data for this context structure. */
 struct _stp_transport_context_data transport_data;
@@ -85,6 +85,12 @@ struct stapregex_match {
 } last_match;
 #endif
 
+/* Only used when if/else-if regexp tests were fused into one scan:
+   the index of the first pattern that matched, 0 if none. */
+#ifdef STAP_NEED_CONTEXT_REGEX_SET
+int last_regex_set;
+#endif
+
 /* NB: last_error is used as a health flag within a probe.
    While it's 0, execution continues
    When it's "something", probe code unwinds, _stp_error's, sets error state */
@@ -130,9 +136,22 @@ union {
 
   /* State for procfs probes, see tapset-procfs.cxx.  */
   void *procfs_data;
+
+  /* The sample being handled by a batched perf probe, see
+     tapset-perfmon.cxx and the perf.stp tapset.  */
+  struct {
+    unsigned long pc;
+    pid_t pid;
+    pid_t tid;
+    int user_mode_p;
+  } perf_sample;
 } ips;
 
 
+/* Set while a batched perf probe runs its handler over queued samples,
+   i.e. while ips.perf_sample is valid.  */
+int perf_sample_p;
+
 /* Only used when stap script uses the i386 or x86_64 register.stp tapset. */
 #ifdef STAP_NEED_REGPARM
 int regparm;
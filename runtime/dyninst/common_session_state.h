@@ -4,6 +4,7 @@
 
 // Forward declarations for things in runtime/dyninst/shm.c
 static void *_stp_shm_base;
+static int _stp_shm_reserve(size_t size);
 static void *_stp_shm_alloc(size_t size);
 
 #include "session_attributes.h"
@@ -169,14 +170,20 @@ static inline struct _stp_transport_session_data *stp_transport_data(void)
 #endif
 
 
+// The size of the session, including the contexts with their print and
+// log buffers.
+static size_t stp_session_size(void)
+{
+	return sizeof(struct stp_runtime_session)
+		+ sizeof(struct context) * _stp_runtime_num_contexts;
+}
+
 static int stp_session_init(void)
 {
 	size_t i;
 
 	// Reserve space for the session at the beginning of shared memory.
-	size_t session_size = sizeof(struct stp_runtime_session)
-		+ sizeof(struct context) * _stp_runtime_num_contexts;
-	void *session = _stp_shm_zalloc(session_size);
+	void *session = _stp_shm_zalloc(stp_session_size());
 	if (!session)
 		return -ENOMEM;
 
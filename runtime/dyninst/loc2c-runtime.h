@@ -67,11 +67,24 @@
     } \
   })
 
+#define uderef_snapshot(dst, addr, size) ({ \
+	size_t _size = (size); \
+	if (__copy_from_user((void *)(dst), (void *)(uintptr_t)(addr), _size)) { \
+	    memset((void *)(dst), 0, _size); \
+	    DEREF_FAULT(addr); \
+	} \
+	(dst); \
+    })
+
+#define snapshot_read(dst, addr, ptr) \
+	(*(typeof(ptr))((char *)(dst) + ((uintptr_t)(ptr) - (uintptr_t)(addr))))
+
 
 /* We still need to clean the runtime more before these can go away... */
 #define kread uread
 #define kwrite uwrite
 #define kderef uderef
+#define kderef_snapshot uderef_snapshot
 #define store_kderef store_uderef
 
 
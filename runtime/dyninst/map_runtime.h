@@ -149,6 +149,23 @@ _stp_map_init(MAP m, unsigned max_entries, int wrap, int node_size)
 }
 
 
+/* The shared memory taken by _stp_map_new and _stp_pmap_new, which the
+ * translator adds up to presize the shared memory in module init. */
+static size_t _stp_map_shm_size(unsigned max_entries, size_t node_size)
+{
+	return _STP_SHM_ALIGN(sizeof(struct map_root) + node_size * max_entries);
+}
+
+static size_t _stp_pmap_shm_size(unsigned max_entries, size_t node_size)
+{
+	size_t map_size = sizeof(struct map_root) + node_size * max_entries;
+	size_t pmap_size = sizeof(struct pmap) +
+		sizeof(offptr_t) * _stp_runtime_num_contexts;
+	return _STP_SHM_ALIGN(pmap_size +
+			      map_size * (_stp_runtime_num_contexts + 1));
+}
+
+
 /** Create a new map.
  * Maps must be created at module initialization time.
  * @param max_entries The maximum number of entries allowed. Currently that
@@ -22,6 +22,7 @@ static const char* stp_probe_point(size_t index);
 
 /* Defined later in common_session_state.h */
 static inline struct context* stp_session_context(size_t index);
+static inline atomic_t *skipped_count(void);
 
 static int _stp_runtime_num_contexts;
 
@@ -29,6 +30,10 @@ static int _stp_runtime_num_contexts;
  * and _stp_runtime_entryfn_put_context().  */
 static __thread struct context *tls_context;
 
+/* The index of the context this thread used last, which it tries first
+ * next time.  */
+static __thread int tls_context_hint = -1;
+
 static int _stp_runtime_contexts_init(void)
 {
     _stp_runtime_num_contexts = sysconf(_SC_NPROCESSORS_ONLN);
@@ -44,14 +49,9 @@ static int _stp_runtime_contexts_alloc(void)
     /* The allocation was already done in stp_session_init;
      * we just need to initialize the context data.  */
     for (i = 0; i < _stp_runtime_num_contexts; i++) {
-	int rc;
 	struct context *c = stp_session_context(i);
 	c->data_index = i;
-	rc = stp_pthread_mutex_init_shared(&c->lock);
-	if (rc != 0) {
-	    _stp_error("context mutex initialization failed");
-	    return rc;
-	}
+	atomic_set(&c->claimed, 0);
     }
     return 0;
 }
@@ -64,14 +64,8 @@ static int _stp_runtime_contexts_alloc(void)
  */
 static void _stp_runtime_contexts_free(void)
 {
-    int i;
-
-    /* The context memory is managed elsewhere;
-     * we just need to teardown the context locks. */
-    for (i = 0; i < _stp_runtime_num_contexts; i++) {
-	struct context *c = stp_session_context(i);
-	(void)pthread_mutex_destroy(&c->lock);
-    }
+    /* The context memory is managed elsewhere, and claiming contexts
+     * takes no locks that would need a teardown.  */
 }
 
 static int _stp_runtime_get_data_index(void)
@@ -107,50 +101,73 @@ static int _stp_context_index(void)
     return index % _stp_runtime_num_contexts;
 }
 
+/* Try to claim the given context for this thread.  An atomic flag in the
+ * (shared memory) context itself serves as the lock, so claiming a free
+ * context takes a single compare-and-swap.  */
+static inline int _stp_runtime_context_claim(struct context *c)
+{
+    return (atomic_read(&c->claimed) == 0
+	    && pseudo_atomic_cmpxchg(&c->claimed, 0, 1) == 0);
+}
+
 static struct context * _stp_runtime_entryfn_get_context(void)
 {
     struct context *c;
-    int i, index, rc, data_index;
+    int i, tries, index, data_index;
 
     /* If 'tls_context' (which is thread-local storage) is already set
      * for this thread, we are re-entrant, so just quit. */
     if (tls_context != NULL)
 	return NULL;
 
+    /* The context this thread had last time is the most likely to be
+     * free (and still in cache), so try that first. */
+    index = tls_context_hint;
+    if (index >= 0 && index < _stp_runtime_num_contexts) {
+	c = stp_session_context(index);
+	if (_stp_runtime_context_claim(c))
+	    goto found;
+    }
+
     data_index = _stp_context_index();
     if (unlikely(data_index < 0))
 	data_index = 0;
 
-    /* Try to find a free context structure. */
-    index = data_index;
-    for (i = 0; i < _stp_runtime_num_contexts; i++, index++) {
-	if (index >= _stp_runtime_num_contexts)
-	    index = 0;
-	c = stp_session_context(index);
-	if (pthread_mutex_trylock(&c->lock) == 0) {
-	    /* We found a free context structure. Now that it is
-	     * locked, set the TLS pointer and return the context. */
-	    tls_context = c;
-	    return tls_context;
+    /* Try to find a free context structure.  If they are all taken, more
+     * threads than contexts are running probes right now; give them a
+     * chance to finish and try again, but only MAXTRYLOCK times, so a
+     * stuck context can't hang the target.  Then skip the probe, as the
+     * kernel runtime does when its context is busy.  (The prologue
+     * counts the skip itself unless INTERRUPTIBLE.) */
+    for (tries = 0; tries < MAXTRYLOCK; tries++) {
+	index = data_index;
+	for (i = 0; i < _stp_runtime_num_contexts; i++, index++) {
+	    if (index >= _stp_runtime_num_contexts)
+		index = 0;
+	    c = stp_session_context(index);
+	    if (_stp_runtime_context_claim(c))
+		goto found;
 	}
+	sched_yield();
     }
-
-    /* If we're here, we couldn't find a free context structure. Wait
-     * on one. */
-    c = stp_session_context(data_index);
-    rc = pthread_mutex_lock(&c->lock);
-    if (rc == 0) {
-	tls_context = c;
-	return tls_context;
-    }
+#if INTERRUPTIBLE
+    atomic_inc(skipped_count());
+#endif
     return NULL;
+
+found:
+    tls_context_hint = index;
+    tls_context = c;
+    return tls_context;
 }
 
 static void _stp_runtime_entryfn_put_context(struct context *c)
 {
     if (c && c == tls_context) {
 	tls_context = NULL;
-	pthread_mutex_unlock(&c->lock);
+	/* NB: a full barrier, so the handler's writes to the context are
+	 * visible before the next thread can claim it. */
+	(void)pseudo_atomic_cmpxchg(&c->claimed, 1, 0);
     }
     // else, warn about bad state?
     return;
@@ -29,6 +29,7 @@ static void *_stp_shm_base = NULL;
 
 static const char *_stp_shm_init(void);
 static int _stp_shm_connect(const char *name);
+static int _stp_shm_reserve(size_t size);
 static void *_stp_shm_alloc(size_t size);
 static void *_stp_shm_zalloc(size_t size);
 static void _stp_shm_free(void *ptr);
@@ -42,6 +43,11 @@ static void _stp_shm_destroy(void);
 #define shm_dbug(fmt, args...)
 #endif
 
+// Allocations are rounded up to 8-byte aligned sizes, just to be a little
+// safer.  The *_shm_size helpers of the runtime use this too, so that
+// their sums match what _stp_shm_alloc really takes.
+#define _STP_SHM_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
 
 // Create and initialize the shared memory for this module.
 static const char *_stp_shm_init(void)
@@ -138,6 +144,54 @@ static int _stp_shm_connect(const char *name)
 }
 
 
+// Grow the shared memory to hold at least new_size bytes.
+static int _stp_shm_resize(off_t new_size)
+{
+	void *new_base;
+
+	// Round up to the nearest page size
+	off_t rounded = new_size + _stp_shm_page_size - 1;
+	rounded /= _stp_shm_page_size;
+	rounded *= _stp_shm_page_size;
+	if (rounded < new_size)
+		return -EOVERFLOW;
+	if (rounded <= _stp_shm_size)
+		return 0;
+
+	// Try to resize the underlying file.
+	if (ftruncate(_stp_shm_fd, rounded) < 0)
+		return -errno;
+
+	// Try to remap the address in memory.
+	new_base = mremap(_stp_shm_base, _stp_shm_size,
+			  rounded, MREMAP_MAYMOVE);
+	if (new_base == MAP_FAILED)
+		return -errno;
+
+	shm_dbug("resized %" PRIi64 " -> %" PRIi64 " bytes @ %p",
+		 (int64_t)_stp_shm_size, (int64_t)rounded, new_base);
+
+	// Update globals
+	_stp_shm_size = rounded;
+	_stp_shm_base = new_base;
+	return 0;
+}
+
+
+// Make room for a known amount of upcoming allocations in one go, so they
+// don't each have to grow (and possibly move) the shared memory.
+static int _stp_shm_reserve(size_t size)
+{
+	if (_stp_shm_fd < 0)
+		return -EINVAL;
+
+	if (_stp_shm_allocated + (off_t)size < _stp_shm_allocated)
+		return -EOVERFLOW;
+
+	return _stp_shm_resize(_stp_shm_allocated + size);
+}
+
+
 // Allocate space from shared memory
 static void *_stp_shm_alloc(size_t size)
 {
@@ -148,37 +202,24 @@ static void *_stp_shm_alloc(size_t size)
 	if (_stp_shm_fd < 0)
 		return NULL;
 
-	// Round up to 8-byte aligned sizes, just to be a little safer
-	size = (size + 7) & ~7;
+	size = _STP_SHM_ALIGN(size);
 	if (size <= 0)
 		return NULL; // either 0 requested or overflow
 
 	// Check if more memory is needed.
 	if (_stp_shm_size - _stp_shm_allocated < size) {
-		void *new_base;
-
-		// Round up to the nearest page size
-		off_t new_size = _stp_shm_allocated + size;
-		new_size += _stp_shm_page_size - 1;
-		new_size /= _stp_shm_page_size;
-		new_size *= _stp_shm_page_size;
-		if (new_size < _stp_shm_allocated ||
-		    new_size - _stp_shm_allocated < size)
+		off_t needed = _stp_shm_allocated + size;
+		if (needed < _stp_shm_allocated)
 			return NULL; // math overflow?
 
-		// Try to resize the underlying file.
-		if (ftruncate(_stp_shm_fd, new_size) < 0)
-			return NULL;
-
-		// Try to remap the address in memory.
-		new_base = mremap(_stp_shm_base, _stp_shm_size,
-				  new_size, MREMAP_MAYMOVE);
-		if (new_base == MAP_FAILED)
-			return NULL;
-
-		// Update globals
-		_stp_shm_size = new_size;
-		_stp_shm_base = new_base;
+		// Whatever wasn't reserved up front, grow geometrically, so
+		// a series of allocations only resizes a few times.  If the
+		// doubling can't be had, settle for what's needed.
+		if (needed > 2 * _stp_shm_size
+		    || _stp_shm_resize(2 * _stp_shm_size) != 0) {
+			if (_stp_shm_resize(needed) != 0)
+				return NULL;
+		}
 	}
 
 	// Finally return some memory.
@@ -209,6 +250,17 @@ static void _stp_shm_free(void *ptr __attribute__((unused)))
 static void _stp_shm_finalize(void)
 {
 	if (_stp_shm_fd >= 0) {
+		// Give back whatever the reservation or the geometric growth
+		// left unused, so the other processes don't map it.  Shrinking
+		// in place never moves the mapping.
+		off_t used = _stp_shm_allocated + _stp_shm_page_size - 1;
+		used /= _stp_shm_page_size;
+		used *= _stp_shm_page_size;
+		if (used > 0 && used < _stp_shm_size
+		    && ftruncate(_stp_shm_fd, used) == 0
+		    && mremap(_stp_shm_base, _stp_shm_size, used, 0) != MAP_FAILED)
+			_stp_shm_size = used;
+
 		close(_stp_shm_fd);
 		_stp_shm_fd = -1;
 	}
@@ -44,6 +44,15 @@ typedef struct _Stat {
         offptr_t osd[];
 } *Stat;
 
+/* The shared memory taken by _stp_stat_alloc, see _stp_map_shm_size. */
+static size_t _stp_stat_shm_size(size_t stat_data_size)
+{
+	size_t stat_size = sizeof(struct _Stat)
+		+ sizeof(offptr_t) * _stp_runtime_num_contexts;
+	return _STP_SHM_ALIGN(stat_size +
+			      stat_data_size * (_stp_runtime_num_contexts + 1));
+}
+
 static Stat _stp_stat_alloc(size_t stat_data_size)
 {
 	int i;
@@ -18,6 +18,9 @@
 
 #include <sys/syscall.h>
 
+#include <linux/futex.h>
+#include <limits.h>
+
 #include <errno.h>
 #include <string.h>
 #include <search.h>
@@ -31,12 +34,12 @@
 //
 // Each context structure has a '_stp_transport_context_data'
 // structure (described in more detail later) in it, which contains
-// that context's print and log (warning/error) buffers. There is a
-// session-wide double-buffered queue (stored in the
-// '_stp_transport_session_data' structure) where each probe can send
-// print/control messages to a fairly simple consumer thread (see
+// that context's print and log (warning/error) buffers, plus a queue
+// where the probe using that context sends print/control messages to
+// a fairly simple consumer thread (see
 // _stp_dyninst_transport_thread_func() for details). The consumer
-// thread swaps the read/write queues, then handles each request.
+// thread drains every context's queue in batches, then handles each
+// request.
 //
 // Note that there is as little as possible data copying going on. A
 // probe adds data to a print/log buffer stored in shared memory, then
@@ -45,26 +48,36 @@
 //
 // QUEUE OVERVIEW
 //
-// See the session-wide queue's definition in transport.h. It is
-// composed of the '_stp_transport_queue_item', '_stp_transport_queue'
-// and '_stp_transport_session_data' structures.
+// See the queue's definition in transport.h. It is composed of the
+// '_stp_transport_queue_item' and '_stp_transport_queue' structures,
+// with the wakeup state kept in '_stp_transport_session_data'.
+//
+// Each context has its own queue, stored in shared memory. Since a
+// context is only ever held by one probe at a time, each queue has a
+// single producer and the single consumer thread, so no locking is
+// needed: the producer fills in an item and then publishes it by
+// advancing 'tail', the consumer copies out everything between 'head'
+// and 'tail' and then advances 'head'.
+//
+// Wakeups use futexes directly (the shared memory is mapped
+// MAP_SHARED, so these are not process-private futexes). When the
+// consumer thread finds every queue empty, it sets 'consumer_waiting'
+// and sleeps on 'notify'. A producer only touches the shared 'notify'
+// word when it sees 'consumer_waiting' set, so the common case of a
+// busy consumer costs producers no shared cache line writes.
 //
-// The queue is double-buffered and stored in shared memory. Because
-// it is session-wide, and multiple threads can be trying to add data
-// to it simultaneously, the 'queue_mutex' is used to serialize
-// access.  Probes write to the write queue. When the consumer thread
-// realizes data is available, it swaps the read/write queues (by
-// changing the 'write_queue' value) and then processes each
-// '_stp_transport_queue_item' on the read queue.
+// Every item also takes a session-wide sequence number when it is
+// queued, and the consumer merges the queues by it, so output from
+// different contexts still comes out in the order it was produced.
+// (An item whose probe got its number but hasn't published it yet
+// when the consumer drains can still be overtaken by a later one.)
 //
-// If the queue is full, probes will wait on the 'queue_space_avail'
-// condition variable for more space. The consumer thread sets
-// 'queue_space_avail' when it swaps the read/write queues.
+// If a context's queue is full, its probe sets 'producer_waiting' and
+// sleeps on that queue's 'head', which the consumer wakes after
+// advancing it.
 //
-// The consumer thread waits on the 'queue_data_avail' condition
-// variable to know when more items are available. When probes add
-// items to the queue (using __stp_dyninst_transport_queue_add()),
-// 'queue_data_avail' gets set.
+// Exit and exit requests aren't tied to a context, so they are
+// flags/counters in the session data instead of queue items.
 //
 // 
 // LOG BUFFER OVERVIEW
@@ -151,10 +164,6 @@ static int _stp_transport_thread_started = 0;
 #define _STP_D_T_PRINT_ADD(offset, increment) \
 	__STP_D_T_ADD((offset), (increment), _STP_DYNINST_BUFFER_SIZE)
 
-// Return a pointer to the session's current write queue.
-#define _STP_D_T_WRITE_QUEUE(sess_data) \
-	(&((sess_data)->queues[(sess_data)->write_queue]))
-
 // Limit remembered strings in __stp_d_t_eliminate_duplicate_warnings
 #define MAX_STORED_WARNINGS 1024
 
@@ -179,31 +188,77 @@ static void _stp_transport_err (const char *fmt, ...)
 #endif
 
 
+static inline long
+__stp_d_t_futex_wait(unsigned *uaddr, unsigned val)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static inline long
+__stp_d_t_futex_wake(unsigned *uaddr)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Wake the consumer thread if it is (about to go) sleeping. Callers
+// must have published their data with a full barrier first, which
+// pairs with the barrier in _stp_dyninst_transport_thread_func()
+// between setting 'consumer_waiting' and rechecking the queues.
+static void
+__stp_d_t_notify_consumer(struct _stp_transport_session_data *sess_data,
+			  int force)
+{
+	if (force || ACCESS_ONCE(sess_data->consumer_waiting)) {
+		__sync_fetch_and_add(&sess_data->notify, 1);
+		__stp_d_t_futex_wake(&sess_data->notify);
+	}
+}
+
 static void
 __stp_dyninst_transport_queue_add(unsigned type, int data_index,
 				  size_t offset, size_t bytes)
 {
 	struct _stp_transport_session_data *sess_data = stp_transport_data();
+	struct context *c = stp_session_context(data_index);
 
-	if (sess_data == NULL)
+	if (sess_data == NULL || c == NULL)
 		return;
 
-	pthread_mutex_lock(&(sess_data->queue_mutex));
-	// While the write queue is full, wait.
-	while (_STP_D_T_WRITE_QUEUE(sess_data)->items
-	       == (STP_DYNINST_QUEUE_ITEMS - 1)) {
-		pthread_cond_wait(&(sess_data->queue_space_avail),
-				  &(sess_data->queue_mutex));
+	// Only the probe holding this context produces into its
+	// queue, so 'tail' is ours alone.
+	struct _stp_transport_queue *q = &c->transport_data.queue;
+	unsigned tail = q->tail;
+
+	// While the queue is full, wait for the consumer to advance
+	// 'head'.
+	while (tail - ACCESS_ONCE(q->head) >= STP_DYNINST_QUEUE_ITEMS) {
+		unsigned head;
+
+		q->producer_waiting = 1;
+		__sync_synchronize();
+		head = ACCESS_ONCE(q->head);
+		if (tail - head >= STP_DYNINST_QUEUE_ITEMS) {
+			// In case the consumer went to sleep before
+			// the queue filled up.
+			__stp_d_t_notify_consumer(sess_data, 0);
+			__stp_d_t_futex_wait(&q->head, head);
+		}
+		q->producer_waiting = 0;
 	}
-	struct _stp_transport_queue *q = _STP_D_T_WRITE_QUEUE(sess_data);
-	struct _stp_transport_queue_item *item = &(q->queue[q->items]);
-	q->items++;
+
+	struct _stp_transport_queue_item *item
+		= &(q->queue[tail & (STP_DYNINST_QUEUE_ITEMS - 1)]);
 	item->type = type;
 	item->data_index = data_index;
+	item->seq = __sync_fetch_and_add(&sess_data->seq, 1);
 	item->offset = offset;
 	item->bytes = bytes;
-        pthread_cond_signal(&(sess_data->queue_data_avail));
-	pthread_mutex_unlock(&(sess_data->queue_mutex));
+
+	// Publish the item, then see if the consumer needs a kick.
+	__sync_synchronize();
+	ACCESS_ONCE(q->tail) = tail + 1;
+	__sync_synchronize();
+	__stp_d_t_notify_consumer(sess_data, 0);
 }
 
 /* Handle duplicate warning elimination. Returns 0 if we've seen this
@@ -325,10 +380,265 @@ stap_strfloctime(char *buf, size_t max, const char *fmt, time_t t)
 	return (int)ret;
 }
 
+// Handle the OOB items of one context's batch.
+static void
+__stp_d_t_handle_oob(struct _stp_transport_queue_item *batch, unsigned n,
+		     int err_fd)
+{
+	struct _stp_transport_context_data *data = NULL;
+	unsigned freed = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		struct _stp_transport_queue_item *item = &batch[i];
+		int write_data = 1;
+		void *read_ptr;
+
+		if (! (item->type & STP_DYN_OOB_DATA_MASK))
+			continue;
+
+		data = &stp_session_context(item->data_index)->transport_data;
+		read_ptr = data->log_buf + item->offset;
+
+		switch (item->type) {
+		case STP_DYN_OOB_DATA:
+			_stp_transport_debug(
+				"STP_DYN_OOB_DATA (%ld bytes at offset %ld)\n",
+				item->bytes, item->offset);
+
+			/* Note that "WARNING:" should not be
+			 * translated, since it is part of the
+			 * module cmd protocol. */
+			if (strncmp(read_ptr, "WARNING:", 7) == 0) {
+				if (stp_session_attributes()->suppress_warnings) {
+					write_data = 0;
+				}
+				/* If we're not verbose, eliminate
+				 * duplicate warning messages. */
+				else if (stp_session_attributes()->log_level
+					 == 0) {
+					write_data = __stp_d_t_eliminate_duplicate_warnings(read_ptr, item->bytes);
+				}
+			}
+			/* "ERROR:" also should not be translated.  */
+			else if (strncmp(read_ptr, "ERROR:", 5) == 0) {
+				if (_stp_exit_status == 0)
+					_stp_exit_status = 1;
+			}
+
+			if (! write_data) {
+				break;
+			}
+
+			if (_stp_write_retry(err_fd, read_ptr, item->bytes) < 0)
+				_stp_transport_err(
+					"couldn't write %ld bytes OOB data: %s\n",
+					(long)item->bytes, strerror(errno));
+			break;
+
+		case STP_DYN_SYSTEM:
+			_stp_transport_debug("STP_DYN_SYSTEM (%.*s) %d bytes\n",
+				(int)item->bytes, (char *)read_ptr,
+				(int)item->bytes);
+			/*
+			 * Note that the null character is
+			 * already included in the system
+			 * string.
+			 */
+			__stp_d_t_run_command(read_ptr);
+			break;
+		default:
+			_stp_transport_err(
+				"Error - unknown OOB item type %d\n",
+				item->type);
+			break;
+		}
+		freed++;
+	}
+
+	if (freed == 0)
+		return;
+
+	// Release all the log buffers we're done with at once, then
+	// signal there are log buffers available to any waiters.
+	pthread_mutex_lock(&(data->log_mutex));
+	data->log_start = __STP_D_T_ADD(data->log_start, freed,
+					_STP_LOG_BUF_ENTRIES);
+	pthread_cond_signal(&(data->log_space_avail));
+	pthread_mutex_unlock(&(data->log_mutex));
+}
+
+// Handle the normal data items of one context's batch. Items that
+// are contiguous in the print buffer are written out together.
+static void
+__stp_d_t_handle_data(struct _stp_transport_queue_item *batch, unsigned n,
+		      int out_fd)
+{
+	struct _stp_transport_context_data *data = NULL;
+	size_t start = 0, bytes = 0;
+
+	for (unsigned i = 0; i <= n; i++) {
+		struct _stp_transport_queue_item *item
+			= (i < n) ? &batch[i] : NULL;
+
+		if (item != NULL && item->type != STP_DYN_NORMAL_DATA) {
+			if (! (item->type & STP_DYN_OOB_DATA_MASK))
+				_stp_transport_err(
+					"Error - unknown item type"
+					" %d\n", item->type);
+			continue;
+		}
+
+		// Extend the pending run if this item directly
+		// follows it (without wrapping around).
+		if (item != NULL && bytes != 0
+		    && item->offset == _STP_D_T_PRINT_ADD(start, bytes)
+		    && (_STP_D_T_PRINT_NORM(start) + bytes + item->bytes
+			<= _STP_DYNINST_BUFFER_SIZE)) {
+			bytes += item->bytes;
+			continue;
+		}
+
+		if (bytes != 0) {
+			void *read_ptr = (data->print_buf
+					  + _STP_D_T_PRINT_NORM(start));
+			_stp_transport_debug("STP_DYN_NORMAL_DATA"
+				" (%ld bytes at offset %ld)\n",
+				bytes, start);
+			if (_stp_write_retry(out_fd, read_ptr, bytes) < 0)
+				_stp_transport_err(
+					"couldn't write %ld bytes data: %s\n",
+					(long)bytes, strerror(errno));
+		}
+
+		if (item == NULL)
+			break;
+		data = &stp_session_context(item->data_index)->transport_data;
+		start = item->offset;
+		bytes = item->bytes;
+	}
+
+	if (data == NULL)
+		return;
+
+	pthread_mutex_lock(&(data->print_mutex));
+
+	// Now we need to update the read pointer, once for the whole
+	// batch. Note that we're doing this with or without that
+	// context locked, but the print_mutex is locked.
+	data->read_offset = _STP_D_T_PRINT_ADD(start, bytes);
+
+	// Signal more bytes available to any waiters.
+	pthread_cond_signal(&(data->print_space_avail));
+	pthread_mutex_unlock(&(data->print_mutex));
+
+	_stp_transport_debug(
+		"STP_DYN_NORMAL_DATA flushed,"
+		" read_offset %ld, write_offset %ld)\n",
+		data->read_offset, data->write_offset);
+}
+
+// Is queue item sequence number 'a' older than 'b'?
+#define __STP_D_T_SEQ_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+// Drain every context's queue, returning the number of items
+// handled. The queues are merged by sequence number: each round
+// takes the run of items from the queue holding the oldest one that
+// are older than the head of every other queue.
+static unsigned
+__stp_d_t_drain_queues(int out_fd, int err_fd)
+{
+	struct _stp_transport_queue_item batch[STP_DYNINST_QUEUE_ITEMS];
+	unsigned total = 0;
+
+	while (1) {
+		struct _stp_transport_queue *q = NULL;
+		unsigned first_seq = 0, limit_seq = 0;
+		int limited = 0;
+		unsigned head, tail, n;
+		int i;
+
+		for_each_possible_cpu(i) {
+			struct context *c = stp_session_context(i);
+			struct _stp_transport_queue *cq;
+			unsigned seq;
+
+			if (c == NULL)
+				continue;
+			cq = &c->transport_data.queue;
+			if (cq->head == ACCESS_ONCE(cq->tail))
+				continue;
+			__sync_synchronize();
+			seq = cq->queue[cq->head
+					& (STP_DYNINST_QUEUE_ITEMS - 1)].seq;
+
+			if (q == NULL || __STP_D_T_SEQ_BEFORE(seq, first_seq)) {
+				// The previous oldest head is now the
+				// oldest of the other queues.
+				if (q != NULL) {
+					limit_seq = first_seq;
+					limited = 1;
+				}
+				q = cq;
+				first_seq = seq;
+			}
+			else if (! limited
+				 || __STP_D_T_SEQ_BEFORE(seq, limit_seq)) {
+				limit_seq = seq;
+				limited = 1;
+			}
+		}
+		if (q == NULL)
+			break;
+
+		// Copy the run out and hand the slots back before
+		// doing any (slow) output, so the producer isn't held
+		// up by us and can't deadlock against us on
+		// 'print_mutex'.
+		head = q->head;
+		tail = ACCESS_ONCE(q->tail);
+		__sync_synchronize();
+		for (n = 0; head + n != tail; n++) {
+			struct _stp_transport_queue_item *item
+				= &q->queue[(head + n)
+					    & (STP_DYNINST_QUEUE_ITEMS - 1)];
+			if (limited
+			    && ! __STP_D_T_SEQ_BEFORE(item->seq, limit_seq))
+				break;
+			batch[n] = *item;
+		}
+		__sync_synchronize();
+		ACCESS_ONCE(q->head) = head + n;
+		__sync_synchronize();
+		if (ACCESS_ONCE(q->producer_waiting))
+			__stp_d_t_futex_wake(&q->head);
+
+		// Process the run twice. First handle the OOB data
+		// types, then the normal data.
+		__stp_d_t_handle_oob(batch, n, err_fd);
+		__stp_d_t_handle_data(batch, n, out_fd);
+		total += n;
+	}
+	return total;
+}
+
+static int
+__stp_d_t_queues_empty(void)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct context *c = stp_session_context(i);
+		if (c != NULL && (ACCESS_ONCE(c->transport_data.queue.tail)
+				  != c->transport_data.queue.head))
+			return 0;
+	}
+	return 1;
+}
+
 static void *
 _stp_dyninst_transport_thread_func(void *arg __attribute((unused)))
 {
-	int stopping = 0;
+	unsigned exit_requests = 0;
 	int out_fd, err_fd;
 	struct _stp_transport_session_data *sess_data = stp_transport_data();
 
@@ -359,169 +669,41 @@ _stp_dyninst_transport_thread_func(void *arg __attribute((unused)))
 	if (out_fd < 0 || err_fd < 0)
 		return NULL;
 
-	while (! stopping) {
-		struct _stp_transport_queue *q;
-		struct _stp_transport_queue_item *item;
-		struct context *c;
-		struct _stp_transport_context_data *data;
-		void *read_ptr;
-
-		pthread_mutex_lock(&(sess_data->queue_mutex));
-		// While there are no queue entries, wait.
-		q = _STP_D_T_WRITE_QUEUE(sess_data);
-		while (q->items == 0) {
-			// Mutex is locked. It is automatically
-			// unlocked while we are waiting.
-			pthread_cond_wait(&(sess_data->queue_data_avail),
-					  &(sess_data->queue_mutex));
-			// Mutex is locked again.
-		}
-
-		// We've got data. Swap the queues and let any waiters
-		// know there is more space available.
-		sess_data->write_queue ^= 1;
-		pthread_cond_broadcast(&(sess_data->queue_space_avail));
-		pthread_mutex_unlock(&(sess_data->queue_mutex));
-
-		// Note that we're processing the read queue with no
-		// locking. This is possible since no other thread
-		// will be accessing it until we're finished with it
-		// (and we make it the write queue).
-
-		// Process the queue twice. First handle the OOB data types.
-		for (size_t i = 0; i < q->items; i++) {
-			int write_data = 1;
-			item = &(q->queue[i]);
-			if (! (item->type & STP_DYN_OOB_DATA_MASK))
-				continue;
-
-			c = stp_session_context(item->data_index);
-			data = &c->transport_data;
-			read_ptr = data->log_buf + item->offset;
-
-			switch (item->type) {
-			case STP_DYN_OOB_DATA:
-				_stp_transport_debug(
-                                        "STP_DYN_OOB_DATA (%ld bytes at offset %ld)\n",
-					item->bytes, item->offset);
-
-				/* Note that "WARNING:" should not be
-				 * translated, since it is part of the
-				 * module cmd protocol. */
-				if (strncmp(read_ptr, "WARNING:", 7) == 0) {
-					if (stp_session_attributes()->suppress_warnings) {
-						write_data = 0;
-					}
-					/* If we're not verbose, eliminate
-					 * duplicate warning messages. */
-					else if (stp_session_attributes()->log_level
-						 == 0) {
-						write_data = __stp_d_t_eliminate_duplicate_warnings(read_ptr, item->bytes);
-					}
-				}
-				/* "ERROR:" also should not be translated.  */
-				else if (strncmp(read_ptr, "ERROR:", 5) == 0) {
-					if (_stp_exit_status == 0)
-						_stp_exit_status = 1;
-				}
-
-				if (! write_data) {
-					break;
-				}
-
-				if (_stp_write_retry(err_fd, read_ptr, item->bytes) < 0)
-					_stp_transport_err(
-						"couldn't write %ld bytes OOB data: %s\n",
-						(long)item->bytes, strerror(errno));
-				break;
-
-			case STP_DYN_SYSTEM:
-				_stp_transport_debug("STP_DYN_SYSTEM (%.*s) %d bytes\n",
-					(int)item->bytes, (char *)read_ptr,
-					(int)item->bytes);
-				/*
-				 * Note that the null character is
-				 * already included in the system
-				 * string.
-				 */
-				__stp_d_t_run_command(read_ptr);
-				break;
-			default:
-				_stp_transport_err(
-					"Error - unknown OOB item type %d\n",
-					item->type);
-				break;
-			}
+	while (1) {
+		unsigned notify = ACCESS_ONCE(sess_data->notify);
+		int stopping = ACCESS_ONCE(sess_data->exit);
+		unsigned requests;
 
-			// Signal there is a log buffer available to
-			// any waiters.
-			data->log_start = _STP_D_T_LOG_INC(data->log_start);
-			pthread_mutex_lock(&(data->log_mutex));
-			pthread_cond_signal(&(data->log_space_avail));
-			pthread_mutex_unlock(&(data->log_mutex));
+		// Anything queued before the exit flag was raised is
+		// drained by this pass.
+		__sync_synchronize();
+		if (__stp_d_t_drain_queues(out_fd, err_fd) != 0)
+			continue;
+		if (stopping) {
+			_stp_transport_debug("STP_DYN_EXIT\n");
+			break;
 		}
 
-		// Handle the non-OOB data.
-		for (size_t i = 0; i < q->items; i++) {
-			item = &(q->queue[i]);
-
-			switch (item->type) {
-			case STP_DYN_NORMAL_DATA:
-				_stp_transport_debug("STP_DYN_NORMAL_DATA"
-					" (%ld bytes at offset %ld)\n",
-					item->bytes, item->offset);
-				c = stp_session_context(item->data_index);
-				data = &c->transport_data;
-				read_ptr = (data->print_buf
-					    + _STP_D_T_PRINT_NORM(item->offset));
-				if (_stp_write_retry(out_fd, read_ptr, item->bytes) < 0)
-					_stp_transport_err(
-						"couldn't write %ld bytes data: %s\n",
-						(long)item->bytes, strerror(errno));
-
-				pthread_mutex_lock(&(data->print_mutex));
-
-				// Now we need to update the read
-				// pointer, using the data_index we
-				// received. Note that we're doing
-				// this with or without that context
-				// locked, but the print_mutex is
-				// locked.
-				data->read_offset = _STP_D_T_PRINT_ADD(item->offset, item->bytes);
-
-				// Signal more bytes available to any waiters.
-				pthread_cond_signal(&(data->print_space_avail));
-				pthread_mutex_unlock(&(data->print_mutex));
-
-				_stp_transport_debug(
-					"STP_DYN_NORMAL_DATA flushed,"
-					" read_offset %ld, write_offset %ld)\n",
-					data->read_offset, data->write_offset);
-				break;
-
-			case STP_DYN_EXIT:
-				_stp_transport_debug("STP_DYN_EXIT\n");
-				stopping = 1;
-				break;
-
-			case STP_DYN_REQUEST_EXIT:
-				_stp_transport_debug("STP_DYN_REQUEST_EXIT\n");
-				__stp_d_t_request_exit();
-				break;
-
-			default:
-				if (! (item->type & STP_DYN_OOB_DATA_MASK)) {
-					_stp_transport_err(
-						"Error - unknown item type"
-						" %d\n", item->type);
-				}
-				break;
-			}
+		requests = ACCESS_ONCE(sess_data->exit_requests);
+		if (requests != exit_requests) {
+			_stp_transport_debug("STP_DYN_REQUEST_EXIT\n");
+			exit_requests = requests;
+			__stp_d_t_request_exit();
+			continue;
 		}
 
-		// We're now finished with the read queue. Clear it
-		// out.
-		q->items = 0;
+		// Everything is empty, so go to sleep. The barrier
+		// pairs with the one producers issue between
+		// publishing an item and checking
+		// 'consumer_waiting': either they see us waiting and
+		// bump 'notify', or we see their item here.
+		sess_data->consumer_waiting = 1;
+		__sync_synchronize();
+		if (__stp_d_t_queues_empty()
+		    && ! ACCESS_ONCE(sess_data->exit)
+		    && ACCESS_ONCE(sess_data->exit_requests) == exit_requests)
+			__stp_d_t_futex_wait(&sess_data->notify, notify);
+		sess_data->consumer_waiting = 0;
 	}
 	return NULL;
 }
@@ -554,12 +736,24 @@ static int _stp_ctl_send(int type, void *data, unsigned len)
 
 static void _stp_dyninst_transport_signal_exit(void)
 {
-	__stp_dyninst_transport_queue_add(STP_DYN_EXIT, 0, 0, 0);
+	struct _stp_transport_session_data *sess_data = stp_transport_data();
+
+	if (sess_data == NULL)
+		return;
+	__sync_synchronize();
+	ACCESS_ONCE(sess_data->exit) = 1;
+	__sync_synchronize();
+	__stp_d_t_notify_consumer(sess_data, 1);
 }
 
 static void _stp_dyninst_transport_request_exit(void)
 {
-	__stp_dyninst_transport_queue_add(STP_DYN_REQUEST_EXIT, 0, 0, 0);
+	struct _stp_transport_session_data *sess_data = stp_transport_data();
+
+	if (sess_data == NULL)
+		return;
+	__sync_fetch_and_add(&sess_data->exit_requests, 1);
+	__stp_d_t_notify_consumer(sess_data, 1);
 }
 
 static int _stp_dyninst_transport_session_init(void)
@@ -569,24 +763,11 @@ static int _stp_dyninst_transport_session_init(void)
 	// Set up the transport session data.
 	struct _stp_transport_session_data *sess_data = stp_transport_data();
 	if (sess_data != NULL) {
-		rc = stp_pthread_mutex_init_shared(&(sess_data->queue_mutex));
-		if (rc != 0) {
-			_stp_error("transport queue mutex initialization"
-				   " failed");
-			return rc;
-		}
-		rc = stp_pthread_cond_init_shared(&(sess_data->queue_space_avail));
-		if (rc != 0) {
-			_stp_error("transport queue space avail cond variable"
-				   " initialization failed");
-			return rc;
-		}
-		rc = stp_pthread_cond_init_shared(&(sess_data->queue_data_avail));
-		if (rc != 0) {
-			_stp_error("transport queue empty cond variable"
-				   " initialization failed");
-			return rc;
-		}
+		sess_data->notify = 0;
+		sess_data->consumer_waiting = 0;
+		sess_data->seq = 0;
+		sess_data->exit = 0;
+		sess_data->exit_requests = 0;
 	}
 
 	// Set up each context's transport data.
@@ -598,6 +779,10 @@ static int _stp_dyninst_transport_session_init(void)
 		if (c == NULL)
 			continue;
 		data = &c->transport_data;
+		data->queue.head = 0;
+		data->queue.tail = 0;
+		data->queue.producer_waiting = 0;
+
 		rc = stp_pthread_mutex_init_shared(&(data->print_mutex));
 		if (rc != 0) {
 			_stp_error("transport mutex initialization failed");
@@ -706,14 +891,6 @@ static void _stp_dyninst_transport_shutdown(void)
 	pthread_join(_stp_transport_thread, NULL);
 	_stp_transport_thread_started = 0;
 
-	// Tear down the transport session data.
-	struct _stp_transport_session_data *sess_data = stp_transport_data();
-	if (sess_data != NULL) {
-		pthread_mutex_destroy(&(sess_data->queue_mutex));
-		pthread_cond_destroy(&(sess_data->queue_space_avail));
-		pthread_cond_destroy(&(sess_data->queue_data_avail));
-	}
-
 	// Tear down each context's transport data.
 	int i;
 	for_each_possible_cpu(i) {
@@ -45,11 +45,14 @@
 // The total size of the log buffer
 #define _STP_DYNINST_LOG_BUF_LEN (STP_LOG_BUF_LEN * _STP_LOG_BUF_ENTRIES)
 
-// The maximum number of queue items each transport queue can
-// hold.
+// The maximum number of queue items each context's transport queue
+// can hold. Note that it must be a power of 2.
 #ifndef STP_DYNINST_QUEUE_ITEMS
 #define STP_DYNINST_QUEUE_ITEMS 64
 #endif
+#if (STP_DYNINST_QUEUE_ITEMS & (STP_DYNINST_QUEUE_ITEMS - 1)) != 0
+#error "STP_DYNINST_QUEUE_ITEMS must be a power of 2"
+#endif
 
 struct _stp_transport_queue_item {
 	// The type variable lets the thread know what it needs to do.
@@ -59,6 +62,10 @@ struct _stp_transport_queue_item {
 	// working on. */
 	int data_index;
 
+	// Session-wide sequence number, used to hand out the items of
+	// all the queues in the order they were queued.
+	unsigned seq;
+
 	// When 'type' indicates that normal or oob data needs to be
 	// output, this is the data offset.
 	size_t offset;
@@ -68,22 +75,36 @@ struct _stp_transport_queue_item {
 	size_t bytes;
 };
 
+// A single-producer/single-consumer ring. 'head' and 'tail' are
+// free-running item counts; 'head' is only written by the consumer
+// thread and 'tail' only by the probe owning the context. 'head' is
+// also the futex word a producer sleeps on when the ring is full.
 struct _stp_transport_queue {
-	size_t items;
+	unsigned head;
+	unsigned tail;
+	unsigned producer_waiting;
 	struct _stp_transport_queue_item queue[STP_DYNINST_QUEUE_ITEMS];
 };
 
 // This structure is stored in the session data.
 struct _stp_transport_session_data {
-	unsigned write_queue;
-	struct _stp_transport_queue queues[2];
-	pthread_mutex_t queue_mutex;
-	pthread_cond_t queue_space_avail;
-	pthread_cond_t queue_data_avail;
+	// Futex word the consumer thread sleeps on. Bumped by
+	// producers only when 'consumer_waiting' is set.
+	unsigned notify;
+	unsigned consumer_waiting;
+	// The next queue item sequence number.
+	unsigned seq;
+	// Set once by _stp_dyninst_transport_signal_exit().
+	unsigned exit;
+	// Number of STP_DYN_REQUEST_EXIT requests made so far.
+	unsigned exit_requests;
 };
 
 // This structure is stored in every context structure.
 struct _stp_transport_context_data {
+	/* The queue of print/log messages waiting for the consumer. */
+	struct _stp_transport_queue queue;
+
 	/* The buffer and variables used for print messages */
 	size_t read_offset;
 	size_t write_offset;
@@ -879,6 +879,50 @@ extern void __store_deref_bad(void);
 
 #endif /* STAPCONF_PROBE_KERNEL */
 
+/* Copy SIZE bytes at ADDR into the local buffer DST with a single
+ * fault-tolerant block copy.  Code that needs several fields of the
+ * same structure can take one snapshot of it and then pick the fields
+ * out of the copy with snapshot_read(), instead of paying for the
+ * fault handling of a separate kderef()/uderef() per field.
+ *
+ * Like the deref macros, this does a "goto deref_fault" if any part of
+ * the region can't be read.  DST must be at least SIZE bytes long.
+ */
+
+#define _stp_deref_snapshot(dst, addr, size, seg)			      \
+  ({									      \
+    unsigned long _bad;							      \
+    size_t _size = (size);						      \
+    uintptr_t _addr = (uintptr_t)(addr);				      \
+    mm_segment_t _oldfs = get_fs();					      \
+    set_fs(seg);							      \
+    pagefault_disable();						      \
+    if (lookup_bad_addr(_addr, _size)					      \
+	|| !access_ok(VERIFY_READ, (void __user *)_addr, _size))	      \
+      _bad = _size;							      \
+    else								      \
+      _bad = __copy_from_user_inatomic((dst), (void __user *)_addr, _size); \
+    pagefault_enable();							      \
+    set_fs(_oldfs);							      \
+    if (_bad) {								      \
+      memset((char *)(dst) + (_size - _bad), 0, _bad);			      \
+      DEREF_FAULT(addr);						      \
+    }									      \
+    (dst);								      \
+  })
+
+#define kderef_snapshot(dst, addr, size) \
+  _stp_deref_snapshot((dst), (addr), (size), KERNEL_DS)
+#define uderef_snapshot(dst, addr, size) \
+  _stp_deref_snapshot((dst), (addr), (size), USER_DS)
+
+/* Read the object at target address PTR out of a snapshot DST taken
+ * of the region starting at target address ADDR.  PTR must lie within
+ * that region; this is not checked.  */
+
+#define snapshot_read(dst, addr, ptr)					      \
+  (*(typeof(ptr))((char *)(dst) + ((uintptr_t)(ptr) - (uintptr_t)(addr))))
+
 /* Dereference a kernel buffer ADDR of size MAXBYTES. Put the bytes in
  * address DST (which can be NULL).
  *
@@ -886,20 +930,28 @@ extern void __store_deref_bad(void);
  * size that kderef() handles.  This function is very similar to
  * kderef_string(), but kderef_buffer() doesn't quit when finding a
  * '\0' byte or append a '\0' byte.
+ *
+ * The buffer is read in blocks through kderef_snapshot() rather than
+ * byte by byte; when DST is NULL the blocks go to a scratch buffer so
+ * that only the readability of the buffer is checked.
  */
 
 #define kderef_buffer(dst, addr, maxbytes)				      \
   ({									      \
-    uintptr_t _addr;							      \
-    size_t _len;							      \
-    unsigned char _c;							      \
+    uintptr_t _baddr = (uintptr_t)(addr);				      \
+    size_t _blen = (maxbytes);						      \
     char *_d = (dst);							      \
-    for (_len = (maxbytes), _addr = (uintptr_t)(addr);			      \
-	 _len > 1;							      \
-	 --_len, ++_addr)						      \
-      _c = kderef (1, _addr);						      \
-      if (_d)								      \
-	 *_d++ = _c;							      \
+    if (_d)								      \
+      kderef_snapshot(_d, _baddr, _blen);				      \
+    else {								      \
+      char _scratch[64];						      \
+      while (_blen > 0) {						      \
+	size_t _n = min_t(size_t, _blen, sizeof(_scratch));		      \
+	kderef_snapshot(_scratch, _baddr, _n);				      \
+	_baddr += _n;							      \
+	_blen -= _n;							      \
+      }									      \
+    }									      \
     (dst);								      \
   })
 
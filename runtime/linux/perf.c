@@ -79,6 +79,20 @@ static long _stp_perf_init (struct stap_perf_probe *stp, struct task_struct* tas
 	    return -ENOMEM;
 	  }
 
+	  /* and for the samples each cpu queues up, if batched */
+	  BUILD_BUG_ON(sizeof(struct stap_perf_batch)
+		       + STP_PERF_MAX_BATCH * sizeof(((struct stap_perf_batch *)0)->samples[0])
+		       > _STP_MAX_PERCPU_SIZE);
+	  if (stp->batch) {
+	    stp->batches = _stp_alloc_percpu (sizeof(struct stap_perf_batch)
+					      + stp->batch * sizeof(((struct stap_perf_batch *)0)->samples[0]));
+	    if (stp->batches == NULL) {
+	      _stp_free_percpu (stp->e.events);
+	      stp->e.events = NULL;
+	      return -ENOMEM;
+	    }
+	  }
+
 	  /* initialize event on each processor */
 	  for_each_possible_cpu(cpu) {
 	    struct perf_event **event = per_cpu_ptr (stp->e.events, cpu);
@@ -137,7 +151,43 @@ static void _stp_perf_del (struct stap_perf_probe *stp)
     }
     _stp_free_percpu (stp->e.events);
     stp->e.events = NULL;
+    if (stp->batches) {
+      _stp_free_percpu (stp->batches);
+      stp->batches = NULL;
+    }
+  }
+}
+
+
+/** Queue a sample for a batched perf probe.
+ * Called from the overflow handler, possibly in NMI context, so this only
+ * records the sample in this cpu's preallocated batch.  Returns the batch
+ * once it is full, and it's time to run the probe handler over it; the
+ * caller must then reset its len.
+ *
+ * @param stp Handle for the event that overflowed.
+ * @param regs Registers at the time of the sample.
+ */
+static struct stap_perf_batch *
+_stp_perf_batch_add (struct stap_perf_probe *stp, struct pt_regs *regs)
+{
+  struct stap_perf_batch *batch = per_cpu_ptr (stp->batches, smp_processor_id());
+  unsigned len = batch->len;
+
+  /* Still full: we interrupted the handler on its way to drain it. */
+  if (unlikely (len >= stp->batch)) {
+    atomic_inc (skipped_count());
+    return NULL;
   }
+
+  batch->samples[len].pc = instruction_pointer (regs);
+  batch->samples[len].pid = current->tgid;
+  batch->samples[len].tid = current->pid;
+  batch->samples[len].user_mode_p = user_mode (regs) ? 1 : 0;
+  barrier();
+  batch->len = ++len;
+
+  return (len < stp->batch) ? NULL : batch;
 }
 
 
@@ -15,11 +15,26 @@
  * @brief Header file for performance monitoring hardware support
  */
 
+/* Samples queued on one cpu for a batched perf probe, in the same
+ * layout as the context's ips.perf_sample. */
+struct stap_perf_batch {
+	unsigned len;
+	typeof(((struct context *)0)->ips.perf_sample) samples[];
+};
+
+/* The largest batch; a cpu's whole stap_perf_batch has to stay within
+ * _STP_MAX_PERCPU_SIZE.  Keep in sync with perf_builder::build. */
+#define STP_PERF_MAX_BATCH 1024
+
 struct stap_perf_probe {
         struct perf_event_attr attr;
 	perf_overflow_handler_t callback;
 	const struct stap_probe * const probe;
         int per_thread;
+	/* samples per handler run, or 0 to run the handler on every sample */
+	unsigned batch;
+	/* per-cpu struct stap_perf_batch, if batch */
+	void *batches;
         union
 	{
 	  /* per-cpu data. allocated with _stp_alloc_percpu() */
@@ -37,4 +52,7 @@ static long _stp_perf_init (struct stap_perf_probe *stp, struct task_struct* tas
 
 static void _stp_perf_del (struct stap_perf_probe *stp);
 
+static struct stap_perf_batch *
+_stp_perf_batch_add (struct stap_perf_probe *stp, struct pt_regs *regs);
+
 #endif /* _PERF_H_ */
@@ -21,6 +21,9 @@ struct stap_hrtimer_probe {
 	const struct stap_probe * const probe;
 	int64_t intrv;
 	int64_t rnd;
+#ifdef STP_HRTIMER_WHEEL
+	ktime_t next;
+#endif
 };
 
 // The function signature changed in 2.6.21.
@@ -40,6 +43,7 @@ typedef enum hrtimer_restart hrtimer_return_t;
 // autoconf: adapt to HRTIMER_REL -> HRTIMER_MODE_REL renaming near 2.6.21
 #ifdef STAPCONF_HRTIMER_REL
 #define HRTIMER_MODE_REL HRTIMER_REL
+#define HRTIMER_MODE_ABS HRTIMER_ABS
 #endif
 
 
@@ -106,6 +110,96 @@ _stp_hrtimer_cancel(struct stap_hrtimer_probe *stp)
 	hrtimer_cancel(&stp->hrtimer);
 }
 
+
+#ifdef STP_HRTIMER_WHEEL
+
+/* When a script has several timer probes, a single hrtimer serves them
+ * all.  Each probe keeps the time it is next due, and every expiry of the
+ * wheel timer runs all the probes that are due by then, and sleeps until
+ * the earliest next one.  Since all probes start from the same time,
+ * probes with equal periods, or multiples of each other, always come due
+ * together and cost just one wakeup. */
+
+/* Probes due within this many ns after the wheel expiry run along with
+ * it, rather than getting a wakeup of their own. */
+#ifndef STP_HRTIMER_WHEEL_SLACK
+#define STP_HRTIMER_WHEEL_SLACK stap_hrtimer_resolution
+#endif
+
+static struct {
+	struct hrtimer hrtimer;
+	struct stap_hrtimer_probe *probes;
+	unsigned nprobes;
+	void (*run)(struct stap_hrtimer_probe *);
+} _stp_hrtimer_wheel;
+
+
+static hrtimer_return_t _stp_hrtimer_wheel_function(struct hrtimer *timer)
+{
+	int64_t due, next = 0;
+	unsigned i;
+	int running = ((atomic_read (session_state()) == STAP_SESSION_STARTING) ||
+		       (atomic_read (session_state()) == STAP_SESSION_RUNNING));
+
+	due = ktime_to_ns(hrtimer_get_expires(timer)) + STP_HRTIMER_WHEEL_SLACK;
+
+	for (i = 0; i < _stp_hrtimer_wheel.nprobes; i++) {
+		struct stap_hrtimer_probe *stp = &_stp_hrtimer_wheel.probes[i];
+
+		if (ktime_to_ns(stp->next) <= due) {
+			// Update the probe with the next trigger time
+			if (running)
+				stp->next = ktime_add(stp->next,
+						      _stp_hrtimer_get_interval(stp));
+			(*_stp_hrtimer_wheel.run)(stp);
+		}
+
+		if (i == 0 || ktime_to_ns(stp->next) < next)
+			next = ktime_to_ns(stp->next);
+	}
+
+	if (!running)
+		return HRTIMER_NORESTART;
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
+
+static int
+_stp_hrtimer_wheel_create(struct stap_hrtimer_probe *probes, unsigned nprobes,
+			  void (*run)(struct stap_hrtimer_probe *))
+{
+	ktime_t now, next;
+	unsigned i;
+
+	_stp_hrtimer_wheel.probes = probes;
+	_stp_hrtimer_wheel.nprobes = nprobes;
+	_stp_hrtimer_wheel.run = run;
+
+	hrtimer_init(&_stp_hrtimer_wheel.hrtimer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_ABS);
+	_stp_hrtimer_wheel.hrtimer.function = _stp_hrtimer_wheel_function;
+
+	now = next = ktime_get();
+	for (i = 0; i < nprobes; i++) {
+		probes[i].next = ktime_add(now, _stp_hrtimer_get_interval(&probes[i]));
+		if (i == 0 || ktime_to_ns(probes[i].next) < ktime_to_ns(next))
+			next = probes[i].next;
+	}
+
+	(void)hrtimer_start(&_stp_hrtimer_wheel.hrtimer, next, HRTIMER_MODE_ABS);
+	return 0;
+}
+
+
+static void
+_stp_hrtimer_wheel_cancel(void)
+{
+	hrtimer_cancel(&_stp_hrtimer_wheel.hrtimer);
+}
+
+#endif /* STP_HRTIMER_WHEEL */
+
 #else  /* kernel version < 2.6.17 */
 
 #error "not implemented"
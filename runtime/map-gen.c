@@ -633,6 +633,7 @@ static MAP KEYSYM(_stp_map_new) (unsigned max_entries, int wrap)
 /*
  * _stp_map_new_key1_key2...val (num, wrap, HIST_LINEAR, start, end, interval)
  * _stp_map_new_key1_key2...val (num, wrap, HIST_LOG)
+ * _stp_map_new_key1_key2...val (num, wrap, HIST_QUANTILE)
  */ 
 static MAP KEYSYM(_stp_map_new) (unsigned max_entries, int wrap, int htype, ...)
 {
@@ -657,6 +658,10 @@ static MAP KEYSYM(_stp_map_new) (unsigned max_entries, int wrap, int htype, ...)
 		m = _stp_map_new_hstat_log (max_entries, wrap,
 					    sizeof(struct KEYSYM(map_node)));
 		break;
+	case HIST_QUANTILE:
+		m = _stp_map_new_hstat_quantile (max_entries, wrap,
+						 sizeof(struct KEYSYM(map_node)));
+		break;
 	case HIST_LINEAR:
 		m = _stp_map_new_hstat_linear (max_entries, wrap,
 					       sizeof(struct KEYSYM(map_node)),
@@ -28,20 +28,35 @@ static MAP _stp_map_new_hstat (unsigned max_entries, int wrap, int node_size)
 	return m;
 }
 
-static MAP _stp_map_new_hstat_log (unsigned max_entries, int wrap, int node_size)
+/* For histogram types with a fixed number of buckets. */
+static MAP _stp_map_new_hstat_fixed (unsigned max_entries, int wrap,
+				     int node_size, int htype, int buckets)
 {
 	MAP m;
 
 	/* the node already has stat_data, just add size for buckets */
-	node_size += HIST_LOG_BUCKETS * sizeof(int64_t);
+	node_size += buckets * sizeof(int64_t);
 	m = _stp_map_new (max_entries, wrap, node_size, -1);
 	if (m) {
-		m->hist.type = HIST_LOG;
-		m->hist.buckets = HIST_LOG_BUCKETS;
+		m->hist.type = htype;
+		m->hist.buckets = buckets;
 	}
 	return m;
 }
 
+static MAP _stp_map_new_hstat_log (unsigned max_entries, int wrap, int node_size)
+{
+	return _stp_map_new_hstat_fixed (max_entries, wrap, node_size,
+					 HIST_LOG, HIST_LOG_BUCKETS);
+}
+
+static MAP _stp_map_new_hstat_quantile (unsigned max_entries, int wrap,
+					int node_size)
+{
+	return _stp_map_new_hstat_fixed (max_entries, wrap, node_size,
+					 HIST_QUANTILE, HIST_QUANTILE_BUCKETS);
+}
+
 static MAP
 _stp_map_new_hstat_linear (unsigned max_entries, int wrap, int node_size,
 			   int start, int stop, int interval)
@@ -106,13 +121,15 @@ _stp_pmap_new_hstat_linear (unsigned max_entries, int wrap, int node_size,
 	return pmap;
 }
 
+/* For histogram types with a fixed number of buckets. */
 static PMAP
-_stp_pmap_new_hstat_log (unsigned max_entries, int wrap, int node_size)
+_stp_pmap_new_hstat_fixed (unsigned max_entries, int wrap, int node_size,
+			   int htype, int buckets)
 {
 	PMAP pmap;
 
 	/* the node already has stat_data, just add size for buckets */
-	node_size += HIST_LOG_BUCKETS * sizeof(int64_t);
+	node_size += buckets * sizeof(int64_t);
 	pmap = _stp_pmap_new (max_entries, wrap, node_size);
 	if (pmap) {
 		int i;
@@ -120,20 +137,34 @@ _stp_pmap_new_hstat_log (unsigned max_entries, int wrap, int node_size)
 		for_each_possible_cpu(i) {
 			m = _stp_pmap_get_map (pmap, i);
 			MAP_LOCK(m);
-			m->hist.type = HIST_LOG;
-			m->hist.buckets = HIST_LOG_BUCKETS;
+			m->hist.type = htype;
+			m->hist.buckets = buckets;
 			MAP_UNLOCK(m);
 		}
 		/* now set agg map params */
 		m = _stp_pmap_get_agg(pmap);
 		MAP_LOCK(m);
-		m->hist.type = HIST_LOG;
-		m->hist.buckets = HIST_LOG_BUCKETS;
+		m->hist.type = htype;
+		m->hist.buckets = buckets;
 		MAP_UNLOCK(m);
 	}
 	return pmap;
 }
 
+static PMAP
+_stp_pmap_new_hstat_log (unsigned max_entries, int wrap, int node_size)
+{
+	return _stp_pmap_new_hstat_fixed (max_entries, wrap, node_size,
+					  HIST_LOG, HIST_LOG_BUCKETS);
+}
+
+static PMAP
+_stp_pmap_new_hstat_quantile (unsigned max_entries, int wrap, int node_size)
+{
+	return _stp_pmap_new_hstat_fixed (max_entries, wrap, node_size,
+					  HIST_QUANTILE, HIST_QUANTILE_BUCKETS);
+}
+
 static PMAP
 _stp_pmap_new_hstat (unsigned max_entries, int wrap, int node_size)
 {
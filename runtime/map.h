@@ -154,6 +154,7 @@ static MAP _stp_map_new(unsigned max_entries, int wrap, int node_size, int cpu);
 static PMAP _stp_pmap_new(unsigned max_entries, int wrap, int node_size);
 static MAP _stp_map_new_hstat(unsigned max_entries, int wrap, int node_size);
 static MAP _stp_map_new_hstat_log(unsigned max_entries, int wrap, int node_size);
+static MAP _stp_map_new_hstat_quantile(unsigned max_entries, int wrap, int node_size);
 static MAP _stp_map_new_hstat_linear(unsigned max_entries, int wrap, int node_size,
 				     int start, int stop, int interval);
 static void _stp_map_print_histogram(MAP map, stat_data *s);
@@ -170,6 +171,7 @@ static PMAP _stp_pmap_new_hstat_linear (unsigned max_entries, int wrap,
 					int node_size, int start, int stop,
 					int interval);
 static PMAP _stp_pmap_new_hstat_log (unsigned max_entries, int wrap, int node_size);
+static PMAP _stp_pmap_new_hstat_quantile (unsigned max_entries, int wrap, int node_size);
 static PMAP _stp_pmap_new_hstat (unsigned max_entries, int wrap, int node_size);
 static void _stp_pmap_del(PMAP pmap);
 static MAP _stp_pmap_agg (PMAP pmap, map_update_fn update, map_cmp_fn cmp);
@@ -147,6 +147,7 @@ static PMAP KEYSYM(_stp_pmap_new) (unsigned max_entries, int wrap)
 /*
  * _stp_pmap_new_key1_key2...val (num, wrap, HIST_LINEAR, start, end, interval) 
  * _stp_pmap_new_key1_key2...val (num, wrap, HIST_LOG)
+ * _stp_pmap_new_key1_key2...val (num, wrap, HIST_QUANTILE)
  */
 static PMAP
 KEYSYM(_stp_pmap_new) (unsigned max_entries, int wrap, int htype, ...)
@@ -172,6 +173,10 @@ KEYSYM(_stp_pmap_new) (unsigned max_entries, int wrap, int htype, ...)
 		pmap = _stp_pmap_new_hstat_log (max_entries, wrap,
 						sizeof(struct KEYSYM(map_node)));
 		break;
+	case HIST_QUANTILE:
+		pmap = _stp_pmap_new_hstat_quantile (max_entries, wrap,
+						     sizeof(struct KEYSYM(map_node)));
+		break;
 	case HIST_LINEAR:
 		pmap = _stp_pmap_new_hstat_linear (max_entries, wrap,
 						   sizeof(struct KEYSYM(map_node)),
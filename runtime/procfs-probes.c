@@ -4,6 +4,8 @@
 #include <linux/mutex.h>
 #include <linux/fs.h>
 #include <linux/sched.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
 
 #if 0
 // Currently we have to output _stp_procfs_data early in the
@@ -15,6 +17,16 @@ struct _stp_procfs_data {
 };
 #endif
 
+/* A rendering of a .cache read probe, shared by all the readers that
+ * open the file while it is fresh. */
+struct _stp_procfs_snapshot {
+	atomic_t refcount;
+	struct rcu_head rcu;
+	unsigned long stamp;	/* jiffies when rendered */
+	size_t count;
+	char data[];
+};
+
 struct stap_procfs_probe {
 	const char *path;
 	const struct stap_probe * const read_probe;
@@ -29,17 +41,34 @@ struct stap_procfs_probe {
 	struct mutex lock;
 	int opencount;
 	wait_queue_head_t waitq;
+
+	/* For .cache(MS) read probes: the latest rendering, RCU protected */
+	const unsigned cache_ms;
+	struct _stp_procfs_snapshot *snapshot;
 };
 
+static void _stp_proc_put_snapshot(struct _stp_procfs_snapshot *snap);
+
 static inline void _spp_init(struct stap_procfs_probe *spp)
 {
 	init_waitqueue_head(&spp->waitq);
 	spp->opencount = 0;
 	mutex_init(&spp->lock);
+	spp->snapshot = NULL;
 }
 #define _spp_lock(spp)		mutex_lock(&(spp)->lock)
 #define _spp_unlock(spp)	mutex_unlock(&(spp)->lock)
-#define _spp_shutdown(spp)	mutex_destroy(&(spp)->lock)
+
+static inline void _spp_shutdown(struct stap_procfs_probe *spp)
+{
+	if (spp->snapshot) {
+		_stp_proc_put_snapshot(spp->snapshot);
+		spp->snapshot = NULL;
+		/* Let the snapshot's RCU callback finish before we go away. */
+		rcu_barrier();
+	}
+	mutex_destroy(&spp->lock);
+}
 
 static int _stp_proc_fill_read_buffer(struct stap_procfs_probe *spp);
 
@@ -182,4 +211,141 @@ static struct file_operations _stp_proc_fops = {
 	.release	= _stp_proc_release_file,
 };
 
+
+/*
+ * .cache(MS) read probes don't make readers take turns.  The handler's
+ * output is kept as a snapshot, which any number of readers can open
+ * and read at once, without taking the probe or spp locks.  Only when a
+ * reader opens the file with the snapshot older than MS milliseconds is
+ * the handler run again, by one reader, to publish a new snapshot; the
+ * readers still holding the old one are unaffected.
+ */
+
+static void
+_stp_proc_free_snapshot(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct _stp_procfs_snapshot, rcu));
+}
+
+static void
+_stp_proc_put_snapshot(struct _stp_procfs_snapshot *snap)
+{
+	if (atomic_dec_and_test(&snap->refcount))
+		call_rcu(&snap->rcu, _stp_proc_free_snapshot);
+}
+
+/* Returns a reference to the current snapshot, if it is fresh. */
+static struct _stp_procfs_snapshot *
+_stp_proc_get_fresh_snapshot(struct stap_procfs_probe *spp)
+{
+	struct _stp_procfs_snapshot *snap;
+
+	rcu_read_lock();
+	snap = rcu_dereference(spp->snapshot);
+	if (snap && (!time_before(jiffies, snap->stamp
+				  + msecs_to_jiffies(spp->cache_ms))
+		     || !atomic_inc_not_zero(&snap->refcount)))
+		snap = NULL;
+	rcu_read_unlock();
+	return snap;
+}
+
+static struct _stp_procfs_snapshot *
+_stp_proc_get_snapshot(struct stap_procfs_probe *spp)
+{
+	struct _stp_procfs_snapshot *snap, *old;
+	int rc;
+
+	snap = _stp_proc_get_fresh_snapshot(spp);
+	if (snap)
+		return snap;
+
+	_spp_lock(spp);
+
+	/* Somebody else may have rendered it while we waited. */
+	snap = _stp_proc_get_fresh_snapshot(spp);
+	if (snap) {
+		_spp_unlock(spp);
+		return snap;
+	}
+
+	spp->buffer[0] = '\0';
+	spp->count = 0;
+	spp->needs_fill = 1;
+	rc = _stp_proc_fill_read_buffer(spp);
+	if (rc) {
+		_spp_unlock(spp);
+		return ERR_PTR(rc);
+	}
+
+	snap = kmalloc(sizeof(*snap) + spp->count, GFP_KERNEL);
+	if (snap == NULL) {
+		_spp_unlock(spp);
+		return ERR_PTR(-ENOMEM);
+	}
+	atomic_set(&snap->refcount, 2); /* spp's and the caller's */
+	snap->stamp = jiffies;
+	snap->count = spp->count;
+	memcpy(snap->data, spp->buffer, spp->count);
+
+	old = spp->snapshot;
+	rcu_assign_pointer(spp->snapshot, snap);
+	_spp_unlock(spp);
+
+	if (old)
+		_stp_proc_put_snapshot(old);
+	return snap;
+}
+
+static int
+_stp_proc_open_cached_file(struct inode *inode, struct file *filp)
+{
+	struct stap_procfs_probe *spp;
+	struct _stp_procfs_snapshot *snap;
+	int res;
+
+	spp = (struct stap_procfs_probe *)PDE_DATA(inode);
+	if (spp == NULL || spp->read_probe == NULL)
+		return -EINVAL;
+
+	res = generic_file_open(inode, filp);
+	if (res)
+		return res;
+
+	snap = _stp_proc_get_snapshot(spp);
+	if (IS_ERR(snap))
+		return PTR_ERR(snap);
+
+	filp->private_data = snap;
+	return 0;
+}
+
+static int
+_stp_proc_release_cached_file(struct inode *inode, struct file *filp)
+{
+	struct _stp_procfs_snapshot *snap = filp->private_data;
+
+	if (snap != NULL)
+		_stp_proc_put_snapshot(snap);
+	return 0;
+}
+
+static ssize_t
+_stp_proc_read_cached_file(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	struct _stp_procfs_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap->data,
+				       snap->count);
+}
+
+static struct file_operations _stp_proc_cached_fops = {
+	.owner		= THIS_MODULE,
+	.open		= _stp_proc_open_cached_file,
+	.read		= _stp_proc_read_cached_file,
+	.llseek		= generic_file_llseek,
+	.release	= _stp_proc_release_cached_file,
+};
+
 #endif /* _STP_PROCFS_PROBES_C_ */
@@ -640,4 +640,8 @@ static void _stp_stack_user_sprint(char *str, int size, struct context* c,
 
 #endif /* CONFIG_KPROBES */
 
+#ifdef STP_NEED_STACK_TABLE
+#include "stack_table.c"
+#endif
+
 #endif /* _STACK_C_ */
@@ -0,0 +1,226 @@
+/*  -*- linux-c -*-
+ * Stack table: interned backtraces addressed by a compact id
+ * Copyright (C) 2014 Red Hat Inc.
+ *
+ * This file is part of systemtap, and is free software.  You can
+ * redistribute it and/or modify it under the terms of the GNU General
+ * Public License (GPL); either version 2, or (at your option) any
+ * later version.
+ */
+
+/*
+  Included from stack.c when STP_NEED_STACK_TABLE is defined, which is
+  done by the context-stackid.stp tapset.  Instead of formatting a
+  backtrace into a hex string (which then has to be hashed and stored
+  as a string map key), the raw PC array from the unwind cache is
+  interned in a fixed size table and the script only ever sees its
+  index.  Symbolization is deferred until the id is printed.
+
+  The table is open addressed and insert-only.  Slots go from EMPTY to
+  BUSY (claimed by exactly one writer through cmpxchg) to READY, and
+  never change afterwards, so lookups need no locks at all.  Two CPUs
+  racing to insert the very same new stack may end up with two
+  different ids for it; that is rare and only costs a slot.
+*/
+
+#ifndef _STACK_TABLE_C_
+#define _STACK_TABLE_C_
+
+#include <linux/jhash.h>
+
+/* Maximum number of distinct stacks, must be a power of two. */
+#ifndef MAXSTACKIDS
+#define MAXSTACKIDS 4096
+#endif
+
+#if (MAXSTACKIDS & (MAXSTACKIDS - 1)) != 0
+#error "MAXSTACKIDS must be a power of two"
+#endif
+
+/* How many slots an insertion may look at before giving up. */
+#ifndef STP_STACK_TABLE_PROBES
+#define STP_STACK_TABLE_PROBES 32
+#endif
+
+enum _stp_stack_slot_state {
+	_stp_stack_slot_empty = 0,
+	_stp_stack_slot_busy,
+	_stp_stack_slot_ready
+};
+
+struct _stp_stack_entry {
+	int state;
+	u32 hash;
+	unsigned depth;
+	int user;		/* user space stack? */
+	pid_t tgid;		/* owning process of a user space stack */
+	unsigned long pc[MAXBACKTRACE];
+};
+
+static struct _stp_stack_entry *_stp_stack_table = NULL;
+static atomic_t _stp_stack_table_dropped = ATOMIC_INIT(0);
+
+static int _stp_stack_table_init(void)
+{
+	_stp_stack_table = _stp_vzalloc(sizeof(struct _stp_stack_entry)
+					* MAXSTACKIDS);
+	if (_stp_stack_table == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+static void _stp_stack_table_free(void)
+{
+	if (_stp_stack_table != NULL)
+		_stp_vfree(_stp_stack_table);
+	_stp_stack_table = NULL;
+}
+
+static int _stp_stack_entry_match(const struct _stp_stack_entry *e,
+				  u32 hash, const unsigned long *pc,
+				  unsigned depth, int user, pid_t tgid)
+{
+	return (e->hash == hash && e->depth == depth && e->user == user
+		&& e->tgid == tgid
+		&& memcmp(e->pc, pc, depth * sizeof(unsigned long)) == 0);
+}
+
+/* Returns the id (1-based slot index) of the given PC array, adding
+   it to the table when not yet present.  Returns 0 if the stack
+   could not be recorded. */
+static int64_t _stp_stack_table_intern(const unsigned long *pc,
+				       unsigned depth, int user, pid_t tgid)
+{
+	u32 hash;
+	unsigned i, slot;
+
+	if (unlikely(_stp_stack_table == NULL || depth == 0))
+		return 0;
+
+	hash = jhash(pc, depth * sizeof(unsigned long), user ? tgid : 0);
+	slot = hash & (MAXSTACKIDS - 1);
+
+	for (i = 0; i < STP_STACK_TABLE_PROBES; i++) {
+		struct _stp_stack_entry *e = &_stp_stack_table[slot];
+		int state = ACCESS_ONCE(e->state);
+
+		if (state == _stp_stack_slot_empty) {
+			state = cmpxchg(&e->state, _stp_stack_slot_empty,
+					_stp_stack_slot_busy);
+			if (state == _stp_stack_slot_empty) {
+				e->hash = hash;
+				e->depth = depth;
+				e->user = user;
+				e->tgid = tgid;
+				memcpy(e->pc, pc, depth * sizeof(unsigned long));
+				smp_wmb();
+				e->state = _stp_stack_slot_ready;
+				return slot + 1;
+			}
+		}
+
+		if (state == _stp_stack_slot_ready) {
+			smp_rmb();
+			if (_stp_stack_entry_match(e, hash, pc, depth,
+						   user, tgid))
+				return slot + 1;
+		}
+
+		slot = (slot + 1) & (MAXSTACKIDS - 1);
+	}
+
+	if (atomic_inc_return(&_stp_stack_table_dropped) == 1)
+		_stp_warn("Stack table full, further backtraces are not "
+			  "recorded (increase MAXSTACKIDS)\n");
+	return 0;
+}
+
+static const struct _stp_stack_entry *_stp_stack_table_get(int64_t id)
+{
+	const struct _stp_stack_entry *e;
+
+	if (_stp_stack_table == NULL || id <= 0 || id > MAXSTACKIDS)
+		return NULL;
+	e = &_stp_stack_table[id - 1];
+	if (ACCESS_ONCE(e->state) != _stp_stack_slot_ready)
+		return NULL;
+	smp_rmb();
+	return e;
+}
+
+#if defined (CONFIG_KPROBES)
+
+/* The unwind caches already hold the raw PCs; run them to completion
+   and intern whatever they collected. */
+
+static int64_t _stp_stack_kernel_id(struct context *c)
+{
+	unsigned depth;
+
+	if (_stp_stack_kernel_get(c, 0) == 0)
+		return 0;
+	_stp_stack_kernel_get(c, MAXBACKTRACE - 1);
+
+	depth = c->uwcache_kernel.depth;
+	if (depth > 0 && c->uwcache_kernel.pc[depth - 1] == 0)
+		depth--;
+	return _stp_stack_table_intern(c->uwcache_kernel.pc, depth, 0, 0);
+}
+
+static int64_t _stp_stack_user_id(struct context *c)
+{
+	unsigned depth;
+
+	if (_stp_stack_user_get(c, 0) == 0)
+		return 0;
+	_stp_stack_user_get(c, MAXBACKTRACE - 1);
+
+	depth = c->uwcache_user.depth;
+	if (depth > 0 && c->uwcache_user.pc[depth - 1] == 0)
+		depth--;
+	return _stp_stack_table_intern(c->uwcache_user.pc, depth, 1,
+				       current->tgid);
+}
+
+#endif /* CONFIG_KPROBES */
+
+/** Prints the backtrace recorded under the given stack id.
+ * User space addresses can only be symbolized from within the
+ * process that recorded them, elsewhere they are printed as hex.
+ */
+static void _stp_stack_id_print(int64_t id, int sym_flags)
+{
+	const struct _stp_stack_entry *e = _stp_stack_table_get(id);
+	struct task_struct *tsk = NULL;
+	unsigned n;
+
+	if (e == NULL) {
+		if (sym_flags & _STP_SYM_SYMBOL)
+			_stp_printf("<no backtrace for stack id %lld>\n",
+				    (long long) id);
+		else
+			_stp_print("\n");
+		return;
+	}
+
+	if (e->user && current->mm && current->tgid == e->tgid)
+		tsk = current;
+
+	for (n = 0; n < e->depth; n++)
+		_stp_print_addr(e->pc[n], sym_flags, tsk);
+}
+
+static void _stp_stack_id_sprint(char *str, int size, int64_t id,
+				 int sym_flags)
+{
+	/* Same print buffer trick as _stp_stack_kernel_sprint. */
+	_stp_pbuf *pb = per_cpu_ptr(Stp_pbuf, smp_processor_id());
+	_stp_print_flush();
+
+	_stp_stack_id_print(id, sym_flags);
+
+	strlcpy(str, pb->buf, size < (int)pb->len ? size : (int)pb->len);
+	pb->len = 0;
+}
+
+#endif /* _STACK_TABLE_C_ */
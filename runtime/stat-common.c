@@ -123,6 +123,84 @@ static int _stp_val_to_bucket(int64_t val)
 	return res;
 }
 
+/* Returns the quantile sketch bucket of a value.  Like the underflow
+ * bucket of HIST_LINEAR, bucket 0 counts all negative values.  Values
+ * below HIST_QUANTILE_SUB get a bucket each.  Larger ones are grouped
+ * by their highest set bit, and the next STP_QUANTILE_SUB_BITS bits
+ * pick one of HIST_QUANTILE_SUB equal buckets, so no bucket is wider
+ * than 1/HIST_QUANTILE_SUB of its smallest value.
+ */
+static int _stp_val_to_quantile_bucket(int64_t val)
+{
+	int e;
+
+	/* underflow */
+	if (val < 0)
+		return 0;
+	if (val < HIST_QUANTILE_SUB)
+		return 1 + (int) val;
+
+	/* the log histogram bucket gives floor(log2(val)) */
+	e = _stp_val_to_bucket(val) - HIST_LOG_BUCKET0 - 1;
+	return 1 + ((e - STP_QUANTILE_SUB_BITS + 1) << STP_QUANTILE_SUB_BITS)
+		+ (int) ((val >> (e - STP_QUANTILE_SUB_BITS))
+			 & (HIST_QUANTILE_SUB - 1));
+}
+
+/* Given a quantile sketch bucket, not counting the underflow bucket,
+ * return the middle of its range. */
+static int64_t _stp_quantile_bucket_to_val(int num)
+{
+	int group = num >> STP_QUANTILE_SUB_BITS;
+	int64_t low, width;
+
+	if (group == 0)
+		return num;
+	width = 1LL << (group - 1);
+	low = (int64_t) (HIST_QUANTILE_SUB + (num & (HIST_QUANTILE_SUB - 1)))
+		<< (group - 1);
+	return low + (width - 1) / 2;
+}
+
+/** Estimates a quantile of the values added to a quantile sketch.
+ * Finds the bucket holding the ceil(count * num / den)-th smallest
+ * value, and returns its middle, clamped to the exact min and max.
+ * The underflow bucket only holds values in [min, -1], so that range
+ * is used for it.
+ * The den must fit in 32 bits and num must not exceed it; the
+ * translator checks both.
+ */
+static int64_t _stp_stat_quantile(stat_data *sd, int64_t num, int64_t den)
+{
+	uint64_t whole = sd->count, rest;
+	uint32_t rem;
+	int64_t rank, seen = 0, val;
+	int i;
+
+	rem = do_div(whole, (uint32_t) den);
+	rest = (uint64_t) rem * num + den - 1;
+	do_div(rest, (uint32_t) den);
+	rank = whole * num + rest;
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < HIST_QUANTILE_BUCKETS - 1; i++) {
+		seen += sd->histogram[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == 0)
+		val = sd->min + (-1 - sd->min) / 2;
+	else
+		val = _stp_quantile_bucket_to_val(i - 1);
+	if (val < sd->min)
+		val = sd->min;
+	if (val > sd->max)
+		val = sd->max;
+	return val;
+}
+
 #ifndef HIST_WIDTH
 #define HIST_WIDTH 50
 #endif
@@ -288,7 +366,14 @@ static void _stp_stat_print_histogram(Hist st, stat_data *sd)
 	_stp_print_flush();
 }
 
-static void __stp_stat_add(Hist st, stat_data *sd, int64_t val)
+/* Adds val to sd, maintaining only the fields selected by ops (see
+ * STAT_OP_*) and a histogram of the given shape.  The count is always
+ * kept, since it tells whether the data is empty.  The translator
+ * calls this with constant arguments, so the unused updates drop out
+ * and the linear bucket division becomes a multiplication. */
+static inline void ___stp_stat_add(stat_data *sd, int64_t val, int ops,
+				   int type, int start, int interval,
+				   int buckets)
 {
 	int n;
 	if (sd->count == 0) {
@@ -296,21 +381,22 @@ static void __stp_stat_add(Hist st, stat_data *sd, int64_t val)
 		sd->sum = sd->min = sd->max = val;
 	} else {
 		sd->count++;
-		sd->sum += val;
-		if (val > sd->max)
+		if (ops & STAT_OP_SUM)
+			sd->sum += val;
+		if ((ops & STAT_OP_MAX) && val > sd->max)
 			sd->max = val;
-		if (val < sd->min)
+		if ((ops & STAT_OP_MIN) && val < sd->min)
 			sd->min = val;
 	}
-	switch (st->type) {
+	switch (type) {
 	case HIST_LOG:
 		n = _stp_val_to_bucket (val);
-		if (n >= st->buckets)
-			n = st->buckets - 1;
+		if (n >= buckets)
+			n = buckets - 1;
 		sd->histogram[n]++;
 		break;
 	case HIST_LINEAR:
-		val -= st->start;
+		val -= start;
 
 		/* underflow */
 		if (val < 0)
@@ -318,19 +404,29 @@ static void __stp_stat_add(Hist st, stat_data *sd, int64_t val)
 		else {
 			uint64_t tmp = val;
 
-			do_div(tmp, st->interval);
+			do_div(tmp, interval);
 			val = tmp;
 			val++;
 		}
 
 		/* overflow */
-		if (val >= st->buckets - 1)
-			val = st->buckets - 1;
+		if (val >= buckets - 1)
+			val = buckets - 1;
 
 		sd->histogram[val]++;
+		break;
+	case HIST_QUANTILE:
+		sd->histogram[_stp_val_to_quantile_bucket (val)]++;
+		break;
 	default:
 		break;
 	}
 }
 
+static void __stp_stat_add(Hist st, stat_data *sd, int64_t val)
+{
+	___stp_stat_add(sd, val, STAT_OP_ALL, st->type, st->start,
+			st->interval, st->buckets);
+}
+
 #endif /* _STAT_COMMON_C_ */
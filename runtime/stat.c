@@ -33,7 +33,8 @@
  * Stats keep track of count, sum, min and max. Average is computed
  * from the sum and count when required. Histograms are optional.
  * If you want a histogram, you must set "type" to HIST_LOG
- * or HIST_LINEAR when you call _stp_stat_init().
+ * or HIST_LINEAR when you call _stp_stat_init().  HIST_QUANTILE
+ * keeps a fixed size histogram for _stp_stat_quantile() instead.
  *
  * @{
  */
@@ -44,7 +45,7 @@
 /** Initialize a Stat.
  * Call this during probe initialization to create a Stat.
  *
- * @param type HIST_NONE, HIST_LOG, or HIST_LINEAR
+ * @param type HIST_NONE, HIST_LOG, HIST_LINEAR or HIST_QUANTILE
  *
  * For HIST_LOG, the following additional parametrs are required:
  * @param buckets - An integer specifying the number of buckets.
@@ -65,6 +66,8 @@ static Stat _stp_stat_init (int type, ...)
 
 		if (type == HIST_LOG) {
 			buckets = HIST_LOG_BUCKETS;
+		} else if (type == HIST_QUANTILE) {
+			buckets = HIST_QUANTILE_BUCKETS;
 		} else {
 			start = va_arg(ap, int);
 			stop = va_arg(ap, int);
@@ -123,6 +126,28 @@ static void _stp_stat_add (Stat st, int64_t val)
 	STAT_PUT_CPU();
 }
 
+/** Add to a Stat, maintaining only part of it.
+ * Like _stp_stat_add(), but only the statistics named in ops are
+ * updated, and the histogram shape is passed in instead of being
+ * read from the Stat.  The translator emits this with constants
+ * matching the _stp_stat_init() of the Stat.
+ *
+ * @param st Stat
+ * @param val Value to add
+ * @param ops STAT_OP_* flags of the statistics to update
+ * @param type, start, interval, buckets Histogram shape
+ */
+static inline void _stp_stat_add_ops (Stat st, int64_t val, int ops,
+				      int type, int start, int interval,
+				      int buckets)
+{
+	stat_data *sd = _stp_stat_per_cpu_ptr (st, STAT_GET_CPU());
+	STAT_LOCK(sd);
+	___stp_stat_add (sd, val, ops, type, start, interval, buckets);
+	STAT_UNLOCK(sd);
+	STAT_PUT_CPU();
+}
+
 
 static void _stp_stat_clear_data (Stat st, stat_data *sd)
 {
@@ -20,8 +20,24 @@
 #define HIST_LOG_BUCKETS 128
 #define HIST_LOG_BUCKET0 64
 
+/* buckets for the quantile sketch: every power of two is split into
+   2^STP_QUANTILE_SUB_BITS buckets, which bounds the relative error.
+   Bucket 0 counts negative values (underflow). */
+#ifndef STP_QUANTILE_SUB_BITS
+#define STP_QUANTILE_SUB_BITS 4
+#endif
+#define HIST_QUANTILE_SUB (1 << STP_QUANTILE_SUB_BITS)
+#define HIST_QUANTILE_BUCKETS ((64 - STP_QUANTILE_SUB_BITS) * HIST_QUANTILE_SUB + 1)
+
 /** histogram type */
-enum histtype { HIST_NONE, HIST_LOG, HIST_LINEAR };
+enum histtype { HIST_NONE, HIST_LOG, HIST_LINEAR, HIST_QUANTILE };
+
+/** Statistics a script extracts, beyond the count which is always
+    kept.  Only these need to be maintained by _stp_stat_add_ops(). */
+#define STAT_OP_SUM	0x1
+#define STAT_OP_MIN	0x2
+#define STAT_OP_MAX	0x4
+#define STAT_OP_ALL	(STAT_OP_SUM | STAT_OP_MIN | STAT_OP_MAX)
 
 /** Statistics are stored in this struct.  This is per-cpu or per-node data 
     and is variable length due to the unknown size of the histogram. */
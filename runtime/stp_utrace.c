@@ -23,6 +23,7 @@
 #include <linux/freezer.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <trace/events/sched.h>
 #include <trace/events/syscalls.h>
 #include "stp_task_work.c"
@@ -73,17 +74,32 @@ struct utrace {
 
 	struct hlist_node hlist;       /* task_utrace_table linkage */
 	struct task_struct *task;
+	struct rcu_head rcu;	       /* deferred free, see utrace_free() */
 
 	struct task_work work;
 	struct task_work report_work;
 };
 
-#define TASK_UTRACE_HASH_BITS 5
+#define TASK_UTRACE_HASH_BITS 8
 #define TASK_UTRACE_TABLE_SIZE (1 << TASK_UTRACE_HASH_BITS)
 
-static struct hlist_head task_utrace_table[TASK_UTRACE_TABLE_SIZE];
-//DEFINE_MUTEX(task_utrace_mutex);      /* Protects task_utrace_table */
-static DEFINE_SPINLOCK(task_utrace_lock); /* Protects task_utrace_table */
+/*
+ * The task_utrace_table maps tasks to their struct utrace.  Each
+ * bucket has its own lock, which is only taken to add or remove
+ * entries.  Lookups walk the bucket under rcu_read_lock() only, which
+ * is why a struct utrace is freed through call_rcu().
+ */
+struct utrace_bucket {
+	struct hlist_head head;
+	spinlock_t lock;	/* Protects head */
+};
+
+static struct utrace_bucket task_utrace_table[TASK_UTRACE_TABLE_SIZE];
+
+static inline struct utrace_bucket *task_utrace_bucket(struct task_struct *task)
+{
+	return &task_utrace_table[hash_ptr(task, TASK_UTRACE_HASH_BITS)];
+}
 
 static struct kmem_cache *utrace_cachep;
 static struct kmem_cache *utrace_engine_cachep;
@@ -184,7 +200,8 @@ static int utrace_init(void)
 
 	/* initialize the list heads */
 	for (i = 0; i < TASK_UTRACE_TABLE_SIZE; i++) {
-		INIT_HLIST_HEAD(&task_utrace_table[i]);
+		INIT_HLIST_HEAD(&task_utrace_table[i].head);
+		spin_lock_init(&task_utrace_table[i].lock);
 	}
 
 #if !defined(STAPCONF_SIGNAL_WAKE_UP_STATE_EXPORTED)
@@ -286,6 +303,9 @@ static int utrace_exit(void)
 {
 	utrace_shutdown();
 
+	/* Wait for the struct utrace frees queued by call_rcu(). */
+	rcu_barrier();
+
 	if (utrace_cachep)
 		kmem_cache_destroy(utrace_cachep);
 	if (utrace_engine_cachep)
@@ -298,16 +318,22 @@ static int utrace_exit(void)
 static void utrace_resume(struct task_work *work);
 static void utrace_report_work(struct task_work *work);
 
+static void utrace_free_rcu(struct rcu_head *rcu)
+{
+	struct utrace *utrace = container_of(rcu, struct utrace, rcu);
+	kmem_cache_free(utrace_cachep, utrace);
+}
+
 /*
  * Clean up everything associated with @task.utrace.
  *
- * This routine must be called under the task_utrace_lock.
+ * This routine must be called under the task_utrace_table bucket lock.
  */
 static void utrace_cleanup(struct utrace *utrace)
 {
 	struct utrace_engine *engine, *next;
 
-	lockdep_assert_held(&task_utrace_lock);
+	lockdep_assert_held(&task_utrace_bucket(utrace->task)->lock);
 
 	/* Free engines associated with the struct utrace, starting
 	 * with the 'attached' list then doing the 'attaching' list. */
@@ -346,8 +372,8 @@ static void utrace_cleanup(struct utrace *utrace)
 	}
 	spin_unlock(&utrace->lock);
 
-	/* Free the struct utrace itself. */
-	kmem_cache_free(utrace_cachep, utrace);
+	/* Free the struct utrace itself, once lookups are done with it. */
+	call_rcu(&utrace->rcu, utrace_free_rcu);
 #ifdef STP_TF_DEBUG
 	printk(KERN_ERR "%s:%d exit\n", __FUNCTION__, __LINE__);
 #endif
@@ -357,7 +383,7 @@ static void utrace_shutdown(void)
 {
 	int i;
 	struct utrace *utrace;
-	struct hlist_head *head;
+	struct utrace_bucket *bucket;
 	struct hlist_node *node, *node2;
 
 	if (atomic_dec_and_test(&utrace_state) != __UTRACE_UNREGISTERED)
@@ -380,29 +406,29 @@ static void utrace_shutdown(void)
 #ifdef STP_TF_DEBUG
 	printk(KERN_ERR "%s:%d - freeing task-specific\n", __FUNCTION__, __LINE__);
 #endif
-	spin_lock(&task_utrace_lock);
 	for (i = 0; i < TASK_UTRACE_TABLE_SIZE; i++) {
-		head = &task_utrace_table[i];
-		stap_hlist_for_each_entry_safe(utrace, node, node2, head, hlist) {
-			hlist_del(&utrace->hlist);
+		bucket = &task_utrace_table[i];
+		spin_lock(&bucket->lock);
+		stap_hlist_for_each_entry_safe(utrace, node, node2,
+					       &bucket->head, hlist) {
+			hlist_del_rcu(&utrace->hlist);
 			utrace_cleanup(utrace);
 		}
+		spin_unlock(&bucket->lock);
 	}
-	spin_unlock(&task_utrace_lock);
 }
 
 /*
- * This routine must be called under the task_utrace_lock.
+ * This routine must be called either under rcu_read_lock() or under
+ * the task_utrace_table bucket lock for @task.
  */
 static struct utrace *__task_utrace_struct(struct task_struct *task)
 {
-	struct hlist_head *head;
 	struct hlist_node *node;
 	struct utrace *utrace;
 
-	lockdep_assert_held(&task_utrace_lock);
-	head = &task_utrace_table[hash_ptr(task, TASK_UTRACE_HASH_BITS)];
-	stap_hlist_for_each_entry(utrace, node, head, hlist) {
+	stap_hlist_for_each_entry_rcu(utrace, node,
+				      &task_utrace_bucket(task)->head, hlist) {
 		if (utrace->task == task)
 			return utrace;
 	}
@@ -420,6 +446,7 @@ static struct utrace *__task_utrace_struct(struct task_struct *task)
 static bool utrace_task_alloc(struct task_struct *task)
 {
 	struct utrace *utrace = kmem_cache_zalloc(utrace_cachep, GFP_IOFS);
+	struct utrace_bucket *bucket = task_utrace_bucket(task);
 	struct utrace *u;
 
 	if (unlikely(!utrace))
@@ -432,16 +459,15 @@ static bool utrace_task_alloc(struct task_struct *task)
 	stp_init_task_work(&utrace->work, &utrace_resume);
 	stp_init_task_work(&utrace->report_work, &utrace_report_work);
 
-	spin_lock(&task_utrace_lock);
+	spin_lock(&bucket->lock);
 	u = __task_utrace_struct(task);
 	if (u == NULL) {
-		hlist_add_head(&utrace->hlist,
-			       &task_utrace_table[hash_ptr(task, TASK_UTRACE_HASH_BITS)]);
+		hlist_add_head_rcu(&utrace->hlist, &bucket->head);
 	}
 	else {
 		kmem_cache_free(utrace_cachep, utrace);
 	}
-	spin_unlock(&task_utrace_lock);
+	spin_unlock(&bucket->lock);
 
 	return true;
 }
@@ -455,14 +481,17 @@ static bool utrace_task_alloc(struct task_struct *task)
  */
 static void utrace_free(struct utrace *utrace)
 {
+	struct utrace_bucket *bucket;
+
 	if (unlikely(!utrace))
 		return;
 
 	/* Remove this utrace from the mapping list of tasks to
 	 * struct utrace. */
-	spin_lock(&task_utrace_lock);
-	hlist_del(&utrace->hlist);
-	spin_unlock(&task_utrace_lock);
+	bucket = task_utrace_bucket(utrace->task);
+	spin_lock(&bucket->lock);
+	hlist_del_rcu(&utrace->hlist);
+	spin_unlock(&bucket->lock);
 
 	/* Free the utrace struct. */
 #ifdef STP_TF_DEBUG
@@ -494,16 +523,17 @@ static void utrace_free(struct utrace *utrace)
 		utrace->report_work_added = 0;
 	}
 
-	kmem_cache_free(utrace_cachep, utrace);
+	/* Lock-free lookups may still be looking at it. */
+	call_rcu(&utrace->rcu, utrace_free_rcu);
 }
 
 static struct utrace *task_utrace_struct(struct task_struct *task)
 {
 	struct utrace *utrace;
 
-	spin_lock(&task_utrace_lock);
+	rcu_read_lock();
 	utrace = __task_utrace_struct(task);
-	spin_unlock(&task_utrace_lock);
+	rcu_read_unlock();
 	return utrace;
 }
 
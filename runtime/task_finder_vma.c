@@ -2,22 +2,25 @@
 #define TASK_FINDER_VMA_C
 
 #include <linux/list.h>
+#include <linux/rculist.h>
 #include <linux/jhash.h>
 #include <linux/spinlock.h>
 
 #include <linux/fs.h>
 #include <linux/dcache.h>
 
-// __stp_tf_vma_lock protects the hash table.
-// Documentation/spinlocks.txt suggest we can be a bit more clever
-// if we guarantee that in interrupt context we only read, not write
-// the datastructures. We should never change the hash table or the
-// contents in interrupt context (which should only ever call 
-// stap_find_vma_map_info for getting stored vma info). So we might
-// want to look into that if this seems a bottleneck.
-static DEFINE_RWLOCK(__stp_tf_vma_lock);
-
-#define __STP_TF_HASH_BITS 4
+// The vma map is a hash table of per-process vma sets.  Each vma set
+// is an array of the tracked vmas of one process, sorted by vm_start,
+// so lookups are a binary search.  Readers (symbolization, uprobe
+// address lookups, possibly from interrupt context) take no locks at
+// all, they walk the hash bucket under rcu_read_lock_sched().  Writers
+// (mmap/munmap/exec callbacks) take the per-bucket lock, build a new
+// copy of the vma set and swap it in, the old copy is freed after an
+// RCU-sched grace period.  Since probe handlers run with preemption
+// disabled, the path pointers handed out below stay valid for the rest
+// of the handler.
+
+#define __STP_TF_HASH_BITS 8
 #define __STP_TF_TABLE_SIZE (1 << __STP_TF_HASH_BITS)
 
 #ifndef TASK_FINDER_VMA_ENTRY_PATHLEN
@@ -28,9 +31,6 @@ static DEFINE_RWLOCK(__stp_tf_vma_lock);
 
 
 struct __stp_tf_vma_entry {
-	struct hlist_node hlist;
-
-	pid_t pid;
 	unsigned long vm_start;
 	unsigned long vm_end;
         char path[TASK_FINDER_VMA_ENTRY_PATHLEN]; /* mmpath name, if known */
@@ -39,32 +39,57 @@ struct __stp_tf_vma_entry {
 	void *user;
 };
 
-static struct hlist_head *__stp_tf_vma_map;
+struct __stp_tf_vma_set {
+	struct hlist_node hlist;
+	struct rcu_head rcu;
+
+	pid_t pid;
+	unsigned count;
+	struct __stp_tf_vma_entry vmas[]; /* sorted by vm_start */
+};
+
+struct __stp_tf_vma_bucket {
+	struct hlist_head head;
+	spinlock_t lock;	/* serializes writers of head */
+};
 
-// __stp_tf_vma_new_entry(): Returns an newly allocated or NULL.
+static struct __stp_tf_vma_bucket *__stp_tf_vma_map;
+
+// __stp_tf_vma_new_set(): Returns an newly allocated set with room for
+// count entries or NULL.
 // Must only be called from user context.
 // ... except, with inode-uprobes / task-finder2, it can be called from
 // random tracepoints.  So we cannot sleep after all.
-static struct __stp_tf_vma_entry *
-__stp_tf_vma_new_entry(void)
+static struct __stp_tf_vma_set *
+__stp_tf_vma_new_set(unsigned count)
 {
-	struct __stp_tf_vma_entry *entry;
-	size_t size = sizeof (struct __stp_tf_vma_entry);
+	struct __stp_tf_vma_set *set;
+	size_t size = (sizeof (struct __stp_tf_vma_set)
+		       + count * sizeof (struct __stp_tf_vma_entry));
 #ifdef CONFIG_UTRACE
-	entry = (struct __stp_tf_vma_entry *) _stp_kmalloc_gfp(size,
-                                                         STP_ALLOC_SLEEP_FLAGS);
+	set = (struct __stp_tf_vma_set *) _stp_kmalloc_gfp(size,
+							   STP_ALLOC_SLEEP_FLAGS);
 #else
-	entry = (struct __stp_tf_vma_entry *) _stp_kmalloc_gfp(size,
-                                                               STP_ALLOC_FLAGS);
+	set = (struct __stp_tf_vma_set *) _stp_kmalloc_gfp(size,
+							   STP_ALLOC_FLAGS);
 #endif
-	return entry;
+	if (set != NULL)
+		set->count = count;
+	return set;
 }
 
-// __stp_tf_vma_release_entry(): Frees an entry.
+// __stp_tf_vma_release_set(): Frees a set.
 static void
-__stp_tf_vma_release_entry(struct __stp_tf_vma_entry *entry)
+__stp_tf_vma_release_set(struct __stp_tf_vma_set *set)
 {
-	_stp_kfree (entry);
+	_stp_kfree (set);
+}
+
+static void
+__stp_tf_vma_release_set_rcu(struct rcu_head *rcu)
+{
+	__stp_tf_vma_release_set(container_of(rcu, struct __stp_tf_vma_set,
+					      rcu));
 }
 
 // stap_initialize_vma_map():  Initialize the free list.  Grabs the
@@ -75,12 +100,17 @@ __stp_tf_vma_release_entry(struct __stp_tf_vma_entry *entry)
 static int
 stap_initialize_vma_map(void)
 {
-	size_t size = sizeof(struct hlist_head) * __STP_TF_TABLE_SIZE;
-	struct hlist_head *map = (struct hlist_head *) _stp_kzalloc_gfp(size,
-							STP_ALLOC_SLEEP_FLAGS);
+	int i;
+	size_t size = sizeof(struct __stp_tf_vma_bucket) * __STP_TF_TABLE_SIZE;
+	struct __stp_tf_vma_bucket *map = (struct __stp_tf_vma_bucket *)
+		_stp_kzalloc_gfp(size, STP_ALLOC_SLEEP_FLAGS);
 	if (map == NULL)
 		return -ENOMEM;
 
+	for (i = 0; i < __STP_TF_TABLE_SIZE; i++) {
+		INIT_HLIST_HEAD(&map[i].head);
+		spin_lock_init(&map[i].lock);
+	}
 	__stp_tf_vma_map = map;
 	return 0;
 }
@@ -94,71 +124,147 @@ stap_destroy_vma_map(void)
 	if (__stp_tf_vma_map != NULL) {
 		int i;
 		for (i = 0; i < __STP_TF_TABLE_SIZE; i++) {
-			struct hlist_head *head = &__stp_tf_vma_map[i];
+			struct hlist_head *head = &__stp_tf_vma_map[i].head;
 			struct hlist_node *node;
 			struct hlist_node *n;
-			struct __stp_tf_vma_entry *entry = NULL;
+			struct __stp_tf_vma_set *set = NULL;
 
 			if (hlist_empty(head))
 				continue;
 
-		        stap_hlist_for_each_entry_safe(entry, node, n, head, hlist) {
-				hlist_del(&entry->hlist);
-				__stp_tf_vma_release_entry(entry);
+		        stap_hlist_for_each_entry_safe(set, node, n, head, hlist) {
+				hlist_del(&set->hlist);
+				__stp_tf_vma_release_set(set);
 			}
 		}
+		// Let the pending deferred frees finish.
+		rcu_barrier_sched();
 		_stp_kfree(__stp_tf_vma_map);
 	}
 }
 
 
-// __stp_tf_vma_map_hash(): Compute the vma map hash.
-static inline u32
-__stp_tf_vma_map_hash(struct task_struct *tsk)
+// __stp_tf_vma_map_bucket(): Compute the vma map hash bucket.
+static inline struct __stp_tf_vma_bucket *
+__stp_tf_vma_map_bucket(struct task_struct *tsk)
 {
-    return (jhash_1word(tsk->pid, 0) & (__STP_TF_TABLE_SIZE - 1));
+    return &__stp_tf_vma_map[jhash_1word(tsk->pid, 0)
+			     & (__STP_TF_TABLE_SIZE - 1)];
 }
 
-// Get vma_entry if the vma is present in the vma map hash table.
-// Returns NULL if not present.  The __stp_tf_vma_lock must be read locked
-// before calling this function.
-static struct __stp_tf_vma_entry *
-__stp_tf_get_vma_map_entry_internal(struct task_struct *tsk,
-				    unsigned long vm_start)
+// Get the vma set of the given pid.  Returns NULL if not present.
+// Must be called either under rcu_read_lock_sched() or with the
+// bucket lock held.
+static struct __stp_tf_vma_set *
+__stp_tf_get_vma_set(struct __stp_tf_vma_bucket *bucket, pid_t pid)
 {
-	struct hlist_head *head;
 	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
+	struct __stp_tf_vma_set *set;
 
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-	stap_hlist_for_each_entry(entry, node, head, hlist) {
-		if (tsk->pid == entry->pid
-		    && vm_start == entry->vm_start) {
-			return entry;
-		}
+	stap_hlist_for_each_entry_rcu(set, node, &bucket->head, hlist) {
+		if (set->pid == pid)
+			return set;
 	}
 	return NULL;
 }
 
-// Get vma_entry if the vma with the given vm_end is present in the vma map
-// hash table for the tsk.  Returns NULL if not present.
-// The __stp_tf_vma_lock must be read locked before calling this function.
-static struct __stp_tf_vma_entry *
-__stp_tf_get_vma_map_entry_end_internal(struct task_struct *tsk,
-					unsigned long vm_end)
+// Binary search for the index of the first vma starting after addr.
+static unsigned
+__stp_tf_vma_upper_bound(const struct __stp_tf_vma_set *set,
+			 unsigned long addr)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
+	unsigned lo = 0, hi = set->count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (set->vmas[mid].vm_start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// Returns the vma of the set containing addr, or NULL.
+static const struct __stp_tf_vma_entry *
+__stp_tf_vma_search(const struct __stp_tf_vma_set *set, unsigned long addr)
+{
+	unsigned i = __stp_tf_vma_upper_bound(set, addr);
 
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-	stap_hlist_for_each_entry(entry, node, head, hlist) {
-		if (tsk->pid == entry->pid
-		    && vm_end == entry->vm_end) {
-			return entry;
+	if (i > 0 && addr < set->vmas[i - 1].vm_end)
+		return &set->vmas[i - 1];
+	return NULL;
+}
+
+// Sets up a copy-on-write update of the vma set of the given task.
+// Allocates a new set with room for extra more (or less) entries than
+// the current one, and returns with the bucket lock held and *cur
+// pointing to the current set (NULL if there is none).  *new is NULL
+// if the resulting set would be empty.  Returns -ENOMEM with the lock
+// not taken if the allocation fails.
+static int
+__stp_tf_vma_prepare_update(struct __stp_tf_vma_bucket *bucket, pid_t pid,
+			    int extra, unsigned long *flags,
+			    struct __stp_tf_vma_set **cur,
+			    struct __stp_tf_vma_set **new)
+{
+	for (;;) {
+		int count;
+
+		// Allocate outside the lock, the size may have changed
+		// by the time we get it, in which case we just retry.
+		rcu_read_lock_sched();
+		*cur = __stp_tf_get_vma_set(bucket, pid);
+		count = *cur ? (*cur)->count : 0;
+		rcu_read_unlock_sched();
+
+		*new = NULL;
+		if (count + extra > 0) {
+			*new = __stp_tf_vma_new_set(count + extra);
+			if (*new == NULL)
+				return -ENOMEM;
+			(*new)->pid = pid;
 		}
+
+		spin_lock_irqsave(&bucket->lock, *flags);
+		*cur = __stp_tf_get_vma_set(bucket, pid);
+		if ((*cur ? (int) (*cur)->count : 0) == count)
+			return 0;
+		spin_unlock_irqrestore(&bucket->lock, *flags);
+		if (*new)
+			__stp_tf_vma_release_set(*new);
 	}
-	return NULL;
+}
+
+// Publishes new in place of cur, either may be NULL.  Must be called
+// with the bucket lock held, which it releases.
+static void
+__stp_tf_vma_finish_update(struct __stp_tf_vma_bucket *bucket,
+			   unsigned long flags,
+			   struct __stp_tf_vma_set *cur,
+			   struct __stp_tf_vma_set *new)
+{
+	if (cur && new)
+		hlist_replace_rcu(&cur->hlist, &new->hlist);
+	else if (new)
+		hlist_add_head_rcu(&new->hlist, &bucket->head);
+	else if (cur)
+		hlist_del_rcu(&cur->hlist);
+	spin_unlock_irqrestore(&bucket->lock, flags);
+
+	if (cur)
+		call_rcu_sched(&cur->rcu, __stp_tf_vma_release_set_rcu);
+}
+
+// Drops a prepared update, releasing the bucket lock.
+static void
+__stp_tf_vma_abort_update(struct __stp_tf_vma_bucket *bucket,
+			  unsigned long flags,
+			  struct __stp_tf_vma_set *new)
+{
+	spin_unlock_irqrestore(&bucket->lock, flags);
+	if (new)
+		__stp_tf_vma_release_set(new);
 }
 
 
@@ -171,32 +277,32 @@ stap_add_vma_map_info(struct task_struct *tsk,
 		      unsigned long vm_start, unsigned long vm_end,
 		      const char *path, void *user)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
+	struct __stp_tf_vma_bucket *bucket = __stp_tf_vma_map_bucket(tsk);
+	struct __stp_tf_vma_set *cur, *new;
 	struct __stp_tf_vma_entry *entry;
-	struct __stp_tf_vma_entry *new_entry;
 	unsigned long flags;
+	unsigned i, count;
+	int rc;
+
+	rc = __stp_tf_vma_prepare_update(bucket, tsk->pid, 1, &flags,
+					 &cur, &new);
+	if (rc)
+		return rc;
 
-	// Take a write lock, since we are most likely going to write
-	// after reading. But reserve a new entry first outside the lock.
-	new_entry = __stp_tf_vma_new_entry();
-	write_lock_irqsave(&__stp_tf_vma_lock, flags);
-	entry = __stp_tf_get_vma_map_entry_internal(tsk, vm_start);
-	if (entry != NULL) {
-		write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
-		if (new_entry)
-			__stp_tf_vma_release_entry(new_entry);
+	count = cur ? cur->count : 0;
+	i = cur ? __stp_tf_vma_upper_bound(cur, vm_start) : 0;
+	if (i > 0 && cur->vmas[i - 1].vm_start == vm_start) {
+		__stp_tf_vma_abort_update(bucket, flags, new);
 		return -EBUSY;	/* Already there */
 	}
 
-	if (!new_entry) {
-		write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
-		return -ENOMEM;
+	// Fill in the info, keeping the array sorted
+	if (cur) {
+		memcpy(new->vmas, cur->vmas, i * sizeof(*entry));
+		memcpy(new->vmas + i + 1, cur->vmas + i,
+		       (count - i) * sizeof(*entry));
 	}
-
-	// Fill in the info
-	entry = new_entry;
-	entry->pid = tsk->pid;
+	entry = &new->vmas[i];
 	entry->vm_start = vm_start;
 	entry->vm_end = vm_end;
         if (strlen(path) >= TASK_FINDER_VMA_ENTRY_PATHLEN-3)
@@ -211,9 +317,7 @@ stap_add_vma_map_info(struct task_struct *tsk,
           }
 	entry->user = user;
 
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-	hlist_add_head(&entry->hlist, head);
-	write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
+	__stp_tf_vma_finish_update(bucket, flags, cur, new);
 	return 0;
 }
 
@@ -225,23 +329,28 @@ static int
 stap_extend_vma_map_info(struct task_struct *tsk,
 			 unsigned long vm_start, unsigned long vm_end)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
-
+	struct __stp_tf_vma_bucket *bucket = __stp_tf_vma_map_bucket(tsk);
+	struct __stp_tf_vma_set *cur, *new;
 	unsigned long flags;
-	int res = -ESRCH; // Entry not there or doesn't match.
-
-	// Take a write lock, since we are most likely going to write
-	// to the entry after reading, if its vm_end matches our vm_start.
-	write_lock_irqsave(&__stp_tf_vma_lock, flags);
-	entry = __stp_tf_get_vma_map_entry_end_internal(tsk, vm_start);
-	if (entry != NULL) {
-		entry->vm_end = vm_end;
-		res = 0;
+	unsigned i;
+	int rc;
+
+	rc = __stp_tf_vma_prepare_update(bucket, tsk->pid, 0, &flags,
+					 &cur, &new);
+	if (rc)
+		return rc;
+
+	// The entry ending at vm_start is the last one starting before it.
+	i = cur ? __stp_tf_vma_upper_bound(cur, vm_start - 1) : 0;
+	if (i == 0 || cur->vmas[i - 1].vm_end != vm_start) {
+		__stp_tf_vma_abort_update(bucket, flags, new);
+		return -ESRCH; // Entry not there or doesn't match.
 	}
-	write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
-	return res;
+
+	memcpy(new->vmas, cur->vmas, cur->count * sizeof(cur->vmas[0]));
+	new->vmas[i - 1].vm_end = vm_end;
+	__stp_tf_vma_finish_update(bucket, flags, cur, new);
+	return 0;
 }
 
 
@@ -250,54 +359,53 @@ stap_extend_vma_map_info(struct task_struct *tsk,
 static int
 stap_remove_vma_map_info(struct task_struct *tsk, unsigned long vm_start)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
-	int rc = -ESRCH;
-
-	// Take a write lock since we are most likely going to delete
-	// after reading.
+	struct __stp_tf_vma_bucket *bucket = __stp_tf_vma_map_bucket(tsk);
+	struct __stp_tf_vma_set *cur, *new;
 	unsigned long flags;
-	write_lock_irqsave(&__stp_tf_vma_lock, flags);
-	entry = __stp_tf_get_vma_map_entry_internal(tsk, vm_start);
-	if (entry != NULL) {
-		hlist_del(&entry->hlist);
-		__stp_tf_vma_release_entry(entry);
-                rc = 0;
+	unsigned i;
+	int rc;
+
+	rc = __stp_tf_vma_prepare_update(bucket, tsk->pid, -1, &flags,
+					 &cur, &new);
+	if (rc)
+		return rc;
+
+	i = cur ? __stp_tf_vma_upper_bound(cur, vm_start) : 0;
+	if (i == 0 || cur->vmas[i - 1].vm_start != vm_start) {
+		__stp_tf_vma_abort_update(bucket, flags, new);
+		return -ESRCH;
 	}
-	write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
-	return rc;
+
+	i--;
+	if (new) {
+		memcpy(new->vmas, cur->vmas, i * sizeof(cur->vmas[0]));
+		memcpy(new->vmas + i, cur->vmas + i + 1,
+		       (cur->count - i - 1) * sizeof(cur->vmas[0]));
+	}
+	__stp_tf_vma_finish_update(bucket, flags, cur, new);
+	return 0;
 }
 
 // Finds vma info if the vma is present in the vma map hash table for
 // a given task and address (between vm_start and vm_end).
-// Returns -ESRCH if not present.  The __stp_tf_vma_lock must *not* be
-// locked before calling this function.
+// Returns -ESRCH if not present.  Takes no locks, so it is safe to call
+// from any context.
 static int
 stap_find_vma_map_info(struct task_struct *tsk, unsigned long addr,
 		       unsigned long *vm_start, unsigned long *vm_end,
 		       const char **path, void **user)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
-	struct __stp_tf_vma_entry *found_entry = NULL;
+	struct __stp_tf_vma_set *set;
+	const struct __stp_tf_vma_entry *found_entry = NULL;
 	int rc = -ESRCH;
-	unsigned long flags;
 
 	if (__stp_tf_vma_map == NULL)
 		return rc;
 
-	read_lock_irqsave(&__stp_tf_vma_lock, flags);
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-	stap_hlist_for_each_entry(entry, node, head, hlist) {
-		if (tsk->pid == entry->pid
-		    && addr >= entry->vm_start
-		    && addr < entry->vm_end) {
-			found_entry = entry;
-			break;
-		}
-	}
+	rcu_read_lock_sched();
+	set = __stp_tf_get_vma_set(__stp_tf_vma_map_bucket(tsk), tsk->pid);
+	if (set != NULL)
+		found_entry = __stp_tf_vma_search(set, addr);
 	if (found_entry != NULL) {
 		if (vm_start != NULL)
 			*vm_start = found_entry->vm_start;
@@ -309,35 +417,32 @@ stap_find_vma_map_info(struct task_struct *tsk, unsigned long addr,
 			*user = found_entry->user;
 		rc = 0;
 	}
-	read_unlock_irqrestore(&__stp_tf_vma_lock, flags);
+	rcu_read_unlock_sched();
 	return rc;
 }
 
 // Finds vma info if the vma is present in the vma map hash table for
 // a given task with the given user handle.
-// Returns -ESRCH if not present.  The __stp_tf_vma_lock must *not* be
-// locked before calling this function.
+// Returns -ESRCH if not present.  Takes no locks, so it is safe to call
+// from any context.
 static int
 stap_find_vma_map_info_user(struct task_struct *tsk, void *user,
 			    unsigned long *vm_start, unsigned long *vm_end,
 			    const char **path)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct __stp_tf_vma_entry *entry;
-	struct __stp_tf_vma_entry *found_entry = NULL;
+	struct __stp_tf_vma_set *set;
+	const struct __stp_tf_vma_entry *found_entry = NULL;
 	int rc = -ESRCH;
-	unsigned long flags;
+	unsigned i;
 
 	if (__stp_tf_vma_map == NULL)
 		return rc;
 
-	read_lock_irqsave(&__stp_tf_vma_lock, flags);
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-	stap_hlist_for_each_entry(entry, node, head, hlist) {
-		if (tsk->pid == entry->pid
-		    && user == entry->user) {
-			found_entry = entry;
+	rcu_read_lock_sched();
+	set = __stp_tf_get_vma_set(__stp_tf_vma_map_bucket(tsk), tsk->pid);
+	for (i = 0; set != NULL && i < set->count; i++) {
+		if (user == set->vmas[i].user) {
+			found_entry = &set->vmas[i];
 			break;
 		}
 	}
@@ -350,28 +455,20 @@ stap_find_vma_map_info_user(struct task_struct *tsk, void *user,
 			*path = found_entry->path;
 		rc = 0;
 	}
-	read_unlock_irqrestore(&__stp_tf_vma_lock, flags);
+	rcu_read_unlock_sched();
 	return rc;
 }
 
 static int
 stap_drop_vma_maps(struct task_struct *tsk)
 {
-	struct hlist_head *head;
-	struct hlist_node *node;
-	struct hlist_node *n;
-	struct __stp_tf_vma_entry *entry;
+	struct __stp_tf_vma_bucket *bucket = __stp_tf_vma_map_bucket(tsk);
+	struct __stp_tf_vma_set *set;
 
 	unsigned long flags;
-	write_lock_irqsave(&__stp_tf_vma_lock, flags);
-	head = &__stp_tf_vma_map[__stp_tf_vma_map_hash(tsk)];
-        stap_hlist_for_each_entry_safe(entry, node, n, head, hlist) {
-            if (tsk->pid == entry->pid) {
-		    hlist_del(&entry->hlist);
-		    __stp_tf_vma_release_entry(entry);
-            }
-        }
-	write_unlock_irqrestore(&__stp_tf_vma_lock, flags);
+	spin_lock_irqsave(&bucket->lock, flags);
+	set = __stp_tf_get_vma_set(bucket, tsk->pid);
+	__stp_tf_vma_finish_update(bucket, flags, set, NULL);
 	return 0;
 }
 
@@ -39,25 +39,8 @@ static int __stp_cpufreq_notifier_registered = 0;
 #define NSEC_PER_MSEC	1000000L
 #endif
 
-typedef struct __stp_time_t {
-    /* 
-     * A write lock is taken by __stp_time_timer_callback() and
-     * __stp_time_cpufreq_callback().  Neither writer is in interrupt context,
-     * and both disable interrupts before taking the lock, so there should be
-     * no opportunity for deadlock.
-     *
-     * A read lock is taken by _stp_gettimeofday_us().  There is the potential
-     * for this to occur at any time, so there is a slim chance that this will
-     * happen while the write lock is held, and it will be impossible to get a
-     * read lock.  However, we can limit how long we try to get the lock to
-     * avoid a deadlock.
-     *
-     * Note that seqlock is chosen so that readers don't block writers.  It's
-     * also important that readers can attempt a lock from _any_ context (e.g.,
-     * NMI), and some kernels don't have read_trylock.
-     */
-    seqlock_t lock;
-
+/* The timing parameters of one CPU, from which readers interpolate. */
+struct __stp_time_base {
     /* These provide a reference time to correlate cycles to real time */
     int64_t base_ns;
     cycles_t base_cycles;
@@ -66,6 +49,30 @@ typedef struct __stp_time_t {
      * cycle counts from the base time. */
     unsigned int freq;
 
+    /* The same as a fixed point factor: ns = (cycles * mult) >> shift, which
+     * holds for cycle deltas below max_cycles. */
+    uint32_t mult;
+    uint32_t shift;
+    uint64_t max_cycles;
+};
+
+typedef struct __stp_time_t {
+    /*
+     * The base time is kept twice, as a latch: a writer bumps seq before
+     * rewriting each copy, and readers use base[seq & 1], which is always
+     * the copy not being rewritten.  So _stp_gettimeofday_ns() never has
+     * to wait for a writer, even from NMI context or when it interrupted
+     * the writer on its own CPU; it only rereads if a whole update slipped
+     * in while it was copying.
+     *
+     * The lock only serializes writers: __stp_time_timer_callback() and
+     * __stp_time_cpufreq_callback() may update a CPU's time concurrently.
+     * Both disable interrupts while holding it.
+     */
+    unsigned int seq;
+    struct __stp_time_base base[2];
+    spinlock_t lock;
+
     /* Callback used to schedule updates of the base time */
     struct timer_list timer;
 } stp_time_t;
@@ -119,27 +126,81 @@ __stp_ktime_get_real_ts(struct timespec *ts)
 #endif
 }
 
+/* Readers can only use the mult/shift conversion while cycles * mult fits
+   in 64 bits.  Allow for this many seconds of cycles since the base time,
+   well beyond the sync interval; anything older falls back to division. */
+#ifndef STP_TIME_MAX_DELTA
+#define STP_TIME_MAX_DELTA 60 /* s */
+#endif
+
+static void
+__stp_time_calc_mult(struct __stp_time_base *base)
+{
+    uint64_t mult = 0, limit;
+    unsigned int shift;
+
+    base->mult = base->shift = 0;
+    base->max_cycles = 0;
+    if (base->freq == 0)
+        return;
+
+    /* The largest mult allowed: ~0 / (freq [kHz] * 1000 * MAX_DELTA). */
+    limit = ~0ULL;
+    do_div(limit, base->freq);
+    do_div(limit, MSEC_PER_SEC * STP_TIME_MAX_DELTA);
+
+    /* Take the largest shift, i.e. the most precise mult, that fits. */
+    for (shift = 32; shift > 0; shift--) {
+        mult = (uint64_t)NSEC_PER_MSEC << shift;
+        do_div(mult, base->freq);
+        if (mult <= limit && mult <= 0xffffffffULL)
+            break;
+    }
+    if (mult == 0 || mult > limit || mult > 0xffffffffULL)
+        return;
+
+    base->mult = mult;
+    base->shift = shift;
+    base->max_cycles = (uint64_t)base->freq * MSEC_PER_SEC * STP_TIME_MAX_DELTA;
+}
+
+/* Resynchronize the base time of a CPU, with the given frequency.
+ * NB: call this with time->lock held and interrupts disabled. */
+static void
+__stp_time_resync(stp_time_t *time, unsigned int freq)
+{
+    struct __stp_time_base base;
+    struct timespec ts;
+
+    __stp_ktime_get_real_ts(&ts);
+    base.base_cycles = get_cycles();
+    base.base_ns = (NSEC_PER_SEC * (int64_t)ts.tv_sec) + ts.tv_nsec;
+    base.freq = freq;
+    __stp_time_calc_mult(&base);
+
+    /* Steer readers to base[1] while base[0] is rewritten, then back. */
+    time->seq++;
+    smp_wmb();
+    time->base[0] = base;
+    smp_wmb();
+    time->seq++;
+    smp_wmb();
+    time->base[1] = base;
+}
+
 /* The timer callback is in a softIRQ -- interrupts enabled. */
 static void
 __stp_time_timer_callback(unsigned long val)
 {
     unsigned long flags;
     stp_time_t *time;
-    struct timespec ts;
-    int64_t ns;
-    cycles_t cycles;
 
     local_irq_save(flags);
 
-    __stp_ktime_get_real_ts(&ts);
-    cycles = get_cycles();
-    ns = (NSEC_PER_SEC * (int64_t)ts.tv_sec) + ts.tv_nsec;
-
     time = per_cpu_ptr(stp_time, smp_processor_id());
-    write_seqlock(&time->lock);
-    time->base_ns = ns;
-    time->base_cycles = cycles;
-    write_sequnlock(&time->lock);
+    spin_lock(&time->lock);
+    __stp_time_resync(time, time->base[0].freq);
+    spin_unlock(&time->lock);
 
     local_irq_restore(flags);
     /* PR6481: reenable IRQs before resetting the timer.
@@ -154,14 +215,11 @@ __stp_time_timer_callback(unsigned long val)
 static void
 __stp_init_time(void *info)
 {
-    struct timespec ts;
     stp_time_t *time = per_cpu_ptr(stp_time, smp_processor_id());
 
-    seqlock_init(&time->lock);
-    __stp_ktime_get_real_ts(&ts);
-    time->base_cycles = get_cycles();
-    time->base_ns = (NSEC_PER_SEC * (int64_t)ts.tv_sec) + ts.tv_nsec;
-    time->freq = __stp_get_freq();
+    spin_lock_init(&time->lock);
+    time->seq = 0;
+    __stp_time_resync(time, __stp_get_freq());
 
     init_timer(&time->timer);
     time->timer.expires = jiffies + STP_TIME_SYNC_INTERVAL;
@@ -180,27 +238,16 @@ __stp_time_cpufreq_callback(struct notifier_block *self,
 {
     unsigned long flags;
     struct cpufreq_freqs *freqs;
-    int freq_khz;
     stp_time_t *time;
-    struct timespec ts;
-    int64_t ns;
-    cycles_t cycles;
 
     switch (state) {
         case CPUFREQ_POSTCHANGE:
         case CPUFREQ_RESUMECHANGE:
             freqs = (struct cpufreq_freqs *)vfreqs;
-            freq_khz = freqs->new;
             time = per_cpu_ptr(stp_time, freqs->cpu);
-            write_seqlock_irqsave(&time->lock, flags);
-            time->freq = freq_khz;
-            /* Also do the guts of __stp_time_timer_callback. */
-            __stp_ktime_get_real_ts(&ts);
-            cycles = get_cycles();
-            ns = (NSEC_PER_SEC * (int64_t)ts.tv_sec) + ts.tv_nsec;
-            time->base_ns = ns;
-            time->base_cycles = cycles;
-            write_sequnlock_irqrestore(&time->lock, flags);
+            spin_lock_irqsave(&time->lock, flags);
+            __stp_time_resync(time, freqs->new);
+            spin_unlock_irqrestore(&time->lock, flags);
             break;
     }
 
@@ -283,9 +330,9 @@ _stp_init_time(void)
                 int freq_khz = cpufreq_get(cpu);
                 if (freq_khz > 0) {
                     stp_time_t *time = per_cpu_ptr(stp_time, cpu);
-                    write_seqlock_irqsave(&time->lock, flags);
-                    time->freq = freq_khz;
-                    write_sequnlock_irqrestore(&time->lock, flags);
+                    spin_lock_irqsave(&time->lock, flags);
+                    __stp_time_resync(time, freq_khz);
+                    spin_unlock_irqrestore(&time->lock, flags);
                 }
             }
         }
@@ -297,23 +344,13 @@ _stp_init_time(void)
 }
 
 
-#ifndef STP_TIMELOCKDELAY
-#define STP_TIMELOCKDELAY 100 /* ns */
-#endif
-#ifndef STP_TIMELOCKTRIES
-#define STP_TIMELOCKTRIES 10 /* total 1 us */
-#endif
-
 static int64_t
 _stp_gettimeofday_ns(void)
 {
-    int64_t base;
-    cycles_t last;
+    struct __stp_time_base base;
     uint64_t delta;
-    unsigned int freq;
     unsigned int seq;
     stp_time_t *time;
-    int i = 0;
 
     if (!stp_time)
         return -1;
@@ -321,24 +358,14 @@ _stp_gettimeofday_ns(void)
     preempt_disable(); /* XXX: why?  Isn't this is only run from probe handlers? */
     time = per_cpu_ptr(stp_time, smp_processor_id());
 
-    seq = read_seqbegin(&time->lock);
-    base = time->base_ns;
-    last = time->base_cycles;
-    freq = time->freq;
-    while (unlikely(read_seqretry(&time->lock, seq))) { 
-            if (/* very */ unlikely(++i >= STP_TIMELOCKTRIES)) {
-                    preempt_enable_no_resched();
-                    _stp_warn ("_stp_gettimofday_ns seqlock timeout; see STP_TIMELOCK*");
-                    return 0;
-            }
-        ndelay(STP_TIMELOCKDELAY);
-        seq = read_seqbegin(&time->lock);
-        base = time->base_ns;
-        last = time->base_cycles;
-        freq = time->freq;
-    }
+    do {
+        seq = ACCESS_ONCE(time->seq);
+        smp_rmb();
+        base = time->base[seq & 1];
+        smp_rmb();
+    } while (unlikely(ACCESS_ONCE(time->seq) != seq));
 
-    delta = get_cycles() - last;
+    delta = get_cycles() - base.base_cycles;
     preempt_enable_no_resched();
 
 #if defined (__s390__) || defined (__s390x__)
@@ -356,13 +383,17 @@ _stp_gettimeofday_ns(void)
 
 #else /* __s390__ || __s390x__ */
 
-    // Verify units:
-    //   (D cycles) * (1E6 ns/ms) / (F cycles/ms [kHz]) = ns
-    delta *= NSEC_PER_MSEC;
-    if (freq == 0)
-      return 0;
-    do_div(delta, freq);
+    if (likely(delta < base.max_cycles))
+        delta = (delta * base.mult) >> base.shift;
+    else {
+        // Verify units:
+        //   (D cycles) * (1E6 ns/ms) / (F cycles/ms [kHz]) = ns
+        delta *= NSEC_PER_MSEC;
+        if (base.freq == 0)
+          return 0;
+        do_div(delta, base.freq);
+    }
 #endif
 
-    return base + delta;
+    return base.base_ns + delta;
 }
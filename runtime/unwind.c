@@ -1287,13 +1287,27 @@ divzero:
 #undef	POP
 }
 
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+/* The register rules processCFI computes only depend on the unwind
+   table, the pc and where the module is loaded, so hot stacks can skip
+   the FDE search and CFI interpretation entirely.  The cache lives in
+   the (per-cpu) context, so no locking is needed. */
+static struct unwind_rule_cache *
+unwind_rule_cache_slot(struct unwind_context *context,
+		       const void *table, unsigned long pc)
+{
+	unsigned long key = pc ^ (unsigned long) table;
+	return &context->rule_cache[hash_long(key, STP_UNWIND_RULE_CACHE_BITS)];
+}
+#endif
+
 /* Unwind to previous to frame.  Returns 0 if successful, negative
  * number in case of an error.  A positive return means unwinding is finished;
  * don't try to fallback to dumping addresses on the stack. */
 static int unwind_frame(struct unwind_context *context,
 			struct _stp_module *m, struct _stp_section *s,
 			void *table, uint32_t table_len, int is_ehframe,
-			int user, int compat_task)
+			unsigned long base, int user, int compat_task)
 {
 	const u32 *fde = NULL, *cie = NULL;
 	/* The start and end of the CIE CFI instructions. */
@@ -1308,6 +1322,9 @@ static int unwind_frame(struct unwind_context *context,
 	uleb128_t retAddrReg = 0;
 	struct unwind_state *state = &context->state;
 	unsigned long addr;
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+	struct unwind_rule_cache *cached;
+#endif
 
 	if (unlikely(table_len == 0)) {
 		// Don't _stp_warn about this, debug_frame and/or eh_frame
@@ -1320,6 +1337,19 @@ static int unwind_frame(struct unwind_context *context,
 		goto err;
 	}
 
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+	cached = unwind_rule_cache_slot(context, table, pc);
+	if (cached->table == table && cached->pc == pc
+	    && cached->base == base && cached->compat_task == !!compat_task) {
+		dbug_unwind(1, "%s: cached rules for pc=%lx\n", m->path, pc);
+		state->stackDepth = 0;
+		memcpy(&REG_STATE, &cached->rules, sizeof(REG_STATE));
+		retAddrReg = cached->retAddrReg;
+		frame->call_frame = cached->call_frame;
+		goto update_frame;
+	}
+#endif
+
 	/* Sets all rules to default Same value. */
 	memset(state, 0, sizeof(*state));
 
@@ -1430,6 +1460,19 @@ static int unwind_frame(struct unwind_context *context,
 	    || REG_STATE.regs[retAddrReg].where == Nowhere)
 		goto err;
 
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+	/* Remember the rules before the Register rules below get
+	   replaced by the register values of this particular frame. */
+	cached->table = table;
+	cached->pc = pc;
+	cached->base = base;
+	cached->retAddrReg = retAddrReg;
+	cached->call_frame = call_frame;
+	cached->compat_task = !!compat_task;
+	memcpy(&cached->rules, &REG_STATE, sizeof(cached->rules));
+update_frame:
+#endif
+
 	/* update frame */
 	if (REG_STATE.cfa_is_expr) {
 		if (compute_expr(REG_STATE.cfa_expr, frame, &cfa, user, compat_task))
@@ -1601,6 +1644,7 @@ static int unwind(struct unwind_context *context, int user)
 	struct _stp_section *s = NULL;
 	struct unwind_frame_info *frame = &context->info;
 	unsigned long pc = UNW_PC(frame) - frame->call_frame;
+	unsigned long base = 0;
 	int res;
         const char *module_name = 0;
 	/* compat_task is a flag for 32bit process unwinding on a 64-bit
@@ -1616,13 +1660,15 @@ static int unwind(struct unwind_context *context, int user)
 
 	if (user)
 	  {
-	    m = _stp_umod_lookup (pc, current, & module_name, NULL, NULL);
+	    m = _stp_umod_lookup (pc, current, & module_name, &base, NULL);
 	    if (m)
 	      s = &m->sections[0];
 	  }
 	else
           {
             m = _stp_kmod_sec_lookup (pc, &s);
+            if (m && s)
+              base = s->static_addr;
             if (!m) {
 #ifdef STAPCONF_MODULE_TEXT_ADDRESS
                 struct module *ko;
@@ -1651,11 +1697,11 @@ static int unwind(struct unwind_context *context, int user)
 
 	dbug_unwind(1, "trying debug_frame\n");
 	res = unwind_frame (context, m, s, m->debug_frame,
-			    m->debug_frame_len, 0, user, compat_task);
+			    m->debug_frame_len, 0, base, user, compat_task);
 	if (res != 0) {
 	  dbug_unwind(1, "debug_frame failed: %d, trying eh_frame\n", res);
 	  res = unwind_frame (context, m, s, m->eh_frame,
-			      m->eh_frame_len, 1, user, compat_task);
+			      m->eh_frame_len, 1, base, user, compat_task);
 	}
 
         /* This situation occurs where some unwind data was found, but
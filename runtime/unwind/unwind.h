@@ -336,9 +336,31 @@ struct unwind_state {
 	struct unwind_item cie_regs[ARRAY_SIZE(reg_info)];
 };
 
+/* Number of (log2) entries in the per-context cache of register rules
+   produced by processCFI, keyed on the exact pc being unwound.  Set to
+   zero to always interpret the CFI from scratch. */
+#ifndef STP_UNWIND_RULE_CACHE_BITS
+#define STP_UNWIND_RULE_CACHE_BITS 4
+#endif
+
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+struct unwind_rule_cache {
+	const void *table;	/* debug_frame or eh_frame the rules came from */
+	unsigned long pc;
+	unsigned long base;	/* load address of the module or mapping */
+	uleb128_t retAddrReg;
+	unsigned call_frame:1;
+	unsigned compat_task:1;
+	struct unwind_reg_state rules;
+};
+#endif
+
 struct unwind_context {
     struct unwind_frame_info info;
     struct unwind_state state;
+#if STP_UNWIND_RULE_CACHE_BITS > 0
+    struct unwind_rule_cache rule_cache[1 << STP_UNWIND_RULE_CACHE_BITS];
+#endif
 };
 
 static const struct cfa badCFA = { ARRAY_SIZE(reg_info), 1 };
@@ -60,6 +60,7 @@ struct dynprobe_derived_probe_group;
 struct java_derived_probe_group;
 struct embeddedcode;
 struct stapdfa;
+struct stapdfa_set;
 class translator_output;
 struct unparser;
 struct semantic_error;
@@ -73,12 +74,15 @@ struct statistic_decl
 {
   statistic_decl()
     : type(none),
-      linear_low(0), linear_high(0), linear_step(0)
+      linear_low(0), linear_high(0), linear_step(0), stat_ops(0)
   {}
-  enum { none, linear, logarithmic } type;
+  enum { none, linear, logarithmic, quantile } type;
   int64_t linear_low;
   int64_t linear_high;
   int64_t linear_step;
+  // The extractors the script applies, as the runtime's STAT_OP_* flags.
+  enum { op_sum = 0x1, op_min = 0x2, op_max = 0x4 };
+  int stat_ops;
   bool operator==(statistic_decl const & other)
   {
     return type == other.type
@@ -278,6 +282,7 @@ public:
   bool use_script_cache;        // control caching of pass-3/4 output
   bool poison_cache;            // consider the cache to be write-only
   std::string cache_path;       // usually ~/.systemtap/cache
+  std::string system_cache_path; // see get_system_cache_path() in hash.cxx
   std::string hash_path;        // path to the cached script module
   std::string stapconf_path;    // path to the cached stapconf
   stap_hash *base_hash;         // hash common to all caching
@@ -325,6 +330,7 @@ public:
 
   // resolved/compiled regular expressions for the run
   std::map<std::string, stapdfa*> dfas;
+  std::map<std::string, stapdfa_set*> dfa_sets; // fused if/else-if matches
   unsigned dfa_counter;  // used to give unique names
   unsigned dfa_maxstate; // used for subexpression-tracking data structure
   unsigned dfa_maxtag;   // ditto
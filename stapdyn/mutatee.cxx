@@ -128,10 +128,30 @@ class mutatee_freezer {
 };
 
 
+// Simple object to group snippet insertions into one insertion set.
+// Nested uses join the outermost set.
+class mutatee_insertion_set {
+    mutatee& m;
+
+  public:
+    mutatee_insertion_set(mutatee& m): m(m)
+    {
+      m.begin_insertion_set();
+    }
+
+    ~mutatee_insertion_set()
+    {
+      m.finalize_insertion_set();
+    }
+};
+
+
 mutatee::mutatee(BPatch_process* process):
   pid(process? process->getPid() : 0),
   process(process), stap_dso(NULL),
-  utrace_enter_function(NULL)
+  utrace_enter_function(NULL),
+  uprobe_enter_function(NULL), uprobe_use_pt_regs(false),
+  semaphore_type(NULL), insertion_set_depth(0)
 {
   get_dwarf_registers(process, registers);
 }
@@ -264,6 +284,64 @@ mutatee::instrument_global_dynprobe_target(const dynprobe_target& target)
 }
 
 
+void
+mutatee::begin_insertion_set()
+{
+  if (insertion_set_depth++ == 0)
+    process->beginInsertionSet();
+}
+
+
+void
+mutatee::finalize_insertion_set()
+{
+  if (insertion_set_depth == 0 || --insertion_set_depth != 0)
+    return;
+
+  staplog(2) << "finalizing " << snippets.size()
+             << " snippets in pid " << pid << endl;
+  if (!process->finalizeInsertionSet(false))
+    staplog(1) << "finalizeInsertionSet failed in pid " << pid << endl;
+}
+
+
+// Find the stap_dso's uprobe entry function, only once per module.
+bool
+mutatee::find_uprobe_enter_function()
+{
+  if (uprobe_enter_function)
+    return true;
+
+  vector<BPatch_function *> functions;
+
+  // XXX Until we know how to build pt_regs from here, we'll
+  // try the entry function for individual registers first.
+  if (!registers.empty())
+    stap_dso->findFunction("enter_dyninst_uprobe_regs", functions, false);
+  if (!functions.empty())
+    {
+      uprobe_enter_function = functions[0];
+      uprobe_use_pt_regs = false;
+      return true;
+    }
+
+  // If the other entry wasn't found, or we don't have
+  // registers for it anyway, try the form that takes pt_regs*
+  // and we'll just pass NULL.
+  stap_dso->findFunction("enter_dyninst_uprobe", functions, false);
+  if (functions.empty())
+    {
+      stapwarn() << "Couldn't find the uprobe entry function (either " << endl
+                 << "\"enter_dyninst_uprobe_regs\" or \"enter_dyninst_uprobe\"). Uprobe probes"
+                 << endl << "disabled." << endl;
+      return false;
+    }
+  uprobe_enter_function = functions[0];
+  uprobe_use_pt_regs = true;
+  return true;
+}
+
+
 // Given a target and the matching object, instrument all of the probes
 // with calls to the stap_dso's entry function.
 void
@@ -273,14 +351,12 @@ mutatee::instrument_dynprobe_target(BPatch_object* object,
   if (!process || !stap_dso || !object)
     return;
 
-  vector<BPatch_function *> functions;
-  BPatch_function* enter_function = NULL;
-  bool use_pt_regs = false;
-
   staplog(1) << "found target \"" << target.path << "\", inserting "
              << target.probes.size() << " probes" << endl;
 
-  process->beginInsertionSet();
+  // NB: when called from instrument_dynprobes(), this joins the
+  // insertion set covering every object in the process.
+  mutatee_insertion_set mis(*this);
   for (size_t j = 0; j < target.probes.size(); ++j)
     {
       const dynprobe_location& probe = target.probes[j];
@@ -294,34 +370,8 @@ mutatee::instrument_dynprobe_target(BPatch_object* object,
 	  continue;
 	}
 
-      if (! enter_function)
-        {
-	  // XXX Until we know how to build pt_regs from here, we'll
-	  // try the entry function for individual registers first.
-	  if (!registers.empty())
-	    stap_dso->findFunction("enter_dyninst_uprobe_regs", functions,
-				   false);
-	  if (!functions.empty())
-	    enter_function = functions[0];
-
-	  // If the other entry wasn't found, or we don't have
-	  // registers for it anyway, try the form that takes pt_regs*
-	  // and we'll just pass NULL.
-	  if (!enter_function)
-	    {
-	      stap_dso->findFunction("enter_dyninst_uprobe", functions,
-				     false);
-	      if (functions.empty())
-	        {
-		  stapwarn() << "Couldn't find the uprobe entry function (either " << endl
-			     << "\"enter_dyninst_uprobe_regs\" or \"enter_dyninst_uprobe\"). Uprobe probes"
-			     << endl << "disabled." << endl;
-		  return;
-		}
-	      use_pt_regs = true;
-	      enter_function = functions[0];
-	    }
-	}
+      if (!find_uprobe_enter_function())
+        return;
 
       // Convert the file offset to a memory address.
       Dyninst::Address address = object->fileOffsetToAddr(probe.offset);
@@ -387,14 +437,14 @@ mutatee::instrument_dynprobe_target(BPatch_object* object,
       // the registers in whatever form we chose above.
       vector<BPatch_snippet *> args;
       args.push_back(new BPatch_constExpr((int64_t)probe.index));
-      if (use_pt_regs)
+      if (uprobe_use_pt_regs)
         args.push_back(new BPatch_constExpr((void*)NULL)); // pt_regs
       else
         {
           args.push_back(new BPatch_constExpr((unsigned long)registers.size()));
           args.insert(args.end(), registers.begin(), registers.end());
         }
-      BPatch_funcCallExpr call(*enter_function, args);
+      BPatch_funcCallExpr call(*uprobe_enter_function, args);
 
       // Finally write the instrumentation for the probe!
       BPatchSnippetHandle* handle = process->insertSnippet(call, points);
@@ -411,14 +461,14 @@ mutatee::instrument_dynprobe_target(BPatch_object* object,
           else
             {
               // Create a variable to represent this semaphore
-              BPatch_type *sem_type = process->getImage()->findType("unsigned short");
-              BPatch_variableExpr *semaphore = process->createVariable(sem_address, sem_type);
+              if (!semaphore_type)
+                semaphore_type = process->getImage()->findType("unsigned short");
+              BPatch_variableExpr *semaphore = process->createVariable(sem_address, semaphore_type);
               if (semaphore)
                 semaphores.push_back(semaphore);
             }
         }
     }
-  process->finalizeInsertionSet(false);
 }
 
 
@@ -579,9 +629,11 @@ mutatee::instrument_dynprobes(const vector<dynprobe_target>& targets,
   // Match non object/path specific probes.
   instrument_global_dynprobes(targets);
 
-  // Read all of the objects in the process.
+  // Read all of the objects in the process, and instrument them all
+  // in one insertion set, so the process is only patched once.
   vector<BPatch_object *> objects;
   image->getObjects(objects);
+  mutatee_insertion_set mis(*this);
   for (size_t i = 0; i < objects.size(); ++i)
     instrument_object_dynprobes(objects[i], targets);
 }
@@ -652,6 +704,8 @@ mutatee::exec_reset_instrumentation()
   // NB: the utrace attached_probes are saved, so process.end can run as the
   // new process is instrumented.  Thus, no attached_probes.clear() yet.
   utrace_enter_function = NULL;
+  uprobe_enter_function = NULL;
+  semaphore_type = NULL;
 }
 
 
@@ -662,10 +716,11 @@ mutatee::remove_instrumentation()
   if (!process || snippets.empty())
     return;
 
-  process->beginInsertionSet();
-  for (size_t i = 0; i < snippets.size(); ++i)
-    process->deleteSnippet(snippets[i]);
-  process->finalizeInsertionSet(false);
+  {
+    mutatee_insertion_set mis(*this);
+    for (size_t i = 0; i < snippets.size(); ++i)
+      process->deleteSnippet(snippets[i]);
+  }
   snippets.clear();
 
   // Decrement all semaphores
@@ -36,6 +36,12 @@ class mutatee {
     std::vector<dynprobe_location> attached_probes;
     BPatch_function* utrace_enter_function;
 
+    BPatch_function* uprobe_enter_function; // stap_dso's uprobe entry
+    bool uprobe_use_pt_regs; // whether uprobe_enter_function takes pt_regs
+    BPatch_type* semaphore_type; // "unsigned short" in the target
+
+    unsigned insertion_set_depth; // nesting of begin_insertion_set()
+
     // disable implicit constructors by not implementing these
     mutatee (const mutatee& other);
     mutatee& operator= (const mutatee& other);
@@ -47,6 +53,7 @@ class mutatee {
     void instrument_utrace_dynprobe(const dynprobe_location& probe);
     void instrument_global_dynprobe_target(const dynprobe_target& target);
     void instrument_global_dynprobes(const std::vector<dynprobe_target>& targets);
+    bool find_uprobe_enter_function();
 
   public:
     mutatee(BPatch_process* process);
@@ -76,6 +83,11 @@ class mutatee {
     void instrument_dynprobes(const std::vector<dynprobe_target>& targets,
                               bool after_exec_p=false);
 
+    // Group all snippet insertions until the matching (outermost)
+    // finalize_insertion_set() into a single Dyninst insertion set.
+    void begin_insertion_set();
+    void finalize_insertion_set();
+
     // Copy data for forked instrumentation
     void copy_forked_instrumentation(mutatee& other);
 
@@ -633,6 +633,13 @@ state::emit (translator_output *o, const dfa *d) const
       // TODOXXX handle a 'default' set of characters for the largest span...
       // TODOXXX optimize by accepting before end of string whenever possible... (also necessary for proper first-matched-substring selection)
     }
+
+  // Bytes outside NUM_REAL_CHARS have no span; like emit_table(),
+  // take the failure outcome 0 for them instead of falling through:
+  o->newline() << "default:";
+  o->newline(1) << d->outcome_snippets[0];
+  o->newline() << "goto yyfinish;";
+  o->indent(-1);
   o->newline(-1) << "}";
 }
 
@@ -642,6 +649,12 @@ dfa::emit (translator_output *o) const
 #ifdef STAPREGEX_DEBUG_DFA
   print(o);
 #else
+  if (nstates >= STAPREGEX_TABLE_MIN_STATES)
+    {
+      emit_table(o);
+      return;
+    }
+
   o->newline() << "{";
   o->newline(1);
 
@@ -660,6 +673,118 @@ dfa::emit (translator_output *o) const
 #endif
 }
 
+/* Emit a matcher as data instead of code. Characters that no state
+   tells apart are first folded into byte classes, so the transition
+   table is only nstates * nclasses entries. */
+void
+emit_table_matcher (translator_output *o, const vector<vector<int> >& trans,
+                    int initial, const vector<string>& outcome_snippets)
+{
+  o->newline() << "{";
+  o->indent(1);
+
+  if (initial < 0)
+    {
+      o->newline() << outcome_snippets[-1 - initial];
+      o->newline() << "goto yyfinish;";
+      o->newline() << "yyfinish: ;";
+      o->newline(-1) << "}";
+      return;
+    }
+
+  unsigned nstates = trans.size();
+
+  /* Bytes with identical columns share a byte class: */
+  map<vector<int>, unsigned> classes;
+  vector<unsigned> char_class(256);
+  vector<vector<int> > columns;
+  for (unsigned c = 0; c < 256; c++)
+    {
+      vector<int> column(nstates);
+      for (unsigned i = 0; i < nstates; i++)
+        column[i] = trans[i][c];
+      map<vector<int>, unsigned>::iterator it = classes.find(column);
+      if (it == classes.end())
+        {
+          it = classes.insert(make_pair(column, columns.size())).first;
+          columns.push_back(column);
+        }
+      char_class[c] = it->second;
+    }
+
+  const char *entry_type = (nstates < 32768 ? "short" : "int");
+
+  o->newline() << "static const unsigned char yyclass[256] = {";
+  for (unsigned c = 0; c < 256; c++)
+    {
+      if (c % 16 == 0) o->newline() << "  ";
+      o->line() << char_class[c] << ",";
+    }
+  o->newline() << "};";
+
+  o->newline() << "static const " << entry_type << " yytrans["
+               << nstates << "][" << columns.size() << "] = {";
+  for (unsigned i = 0; i < nstates; i++)
+    {
+      o->newline() << "  {";
+      for (unsigned k = 0; k < columns.size(); k++)
+        o->line() << columns[k][i] << ",";
+      o->line() << "},";
+    }
+  o->newline() << "};";
+
+  o->newline() << "int yys = " << initial << ";";
+  o->newline() << "int yyt;";
+  o->newline() << "for (;;) {";
+  o->newline(1) << "yyt = yytrans[yys][yyclass[(unsigned char) *YYCURSOR]];";
+#ifdef STAPREGEX_DEBUG_MATCH
+  o->newline() << "printf(\"READ '%s' %c --> %d\\n\", cur, *YYCURSOR, yyt);";
+#endif
+  o->newline() << "if (yyt < 0)";
+  o->newline(1) << "break;";
+  o->newline(-1) << "YYCURSOR++;";
+  o->newline() << "yys = yyt;";
+  o->newline(-1) << "}";
+
+  o->newline() << "switch (-1 - yyt) {";
+  for (unsigned k = 0; k < outcome_snippets.size(); k++)
+    {
+      o->newline() << "case " << k << ":";
+      o->newline(1) << outcome_snippets[k];
+      o->newline() << "goto yyfinish;";
+      o->indent(-1);
+    }
+  o->newline() << "}";
+
+  o->newline() << "yyfinish: ;";
+  o->newline(-1) << "}";
+}
+
+/* Emit the dfa through emit_table_matcher(). A table entry is either
+   the next state, or -(1 + outcome) for a transition into a final
+   state. A missing transition (in particular, for any byte outside
+   NUM_REAL_CHARS) is treated as the failure outcome 0. */
+void
+dfa::emit_table (translator_output *o) const
+{
+  vector<vector<int> > trans(nstates, vector<int>(256, -1));
+  for (state *s = first; s; s = s->next)
+    for (list<span>::const_iterator it = s->spans.begin();
+         it != s->spans.end(); it++)
+      {
+        int t = (it->to->accepts ? -1 - (int) it->to->accept_outcome
+                 : (int) it->to->label);
+        for (unsigned c = it->lb; c <= (unsigned) it->ub; c++)
+          trans[s->label][c] = t;
+      }
+
+  // XXX: workaround for empty regex
+  int initial = (first->accepts ? -1 - (int) first->accept_outcome
+                 : (int) first->label);
+
+  emit_table_matcher (o, trans, initial, outcome_snippets);
+}
+
 void
 dfa::emit_tagsave (translator_output *o, std::string tag_states,
                    std::string tag_vals, std::string tag_count) const
@@ -120,6 +120,13 @@ struct state {
 
 // ------------------------------------------------------------------------
 
+/* DFAs with at least this many states are emitted as a compressed
+   transition table plus a small interpreter loop (see
+   dfa::emit_table), rather than as open-coded goto/switch blocks: */
+#ifndef STAPREGEX_TABLE_MIN_STATES
+#define STAPREGEX_TABLE_MIN_STATES 24
+#endif
+
 struct dfa {
   ins *orig_nfa;
   state *first, *last; // -- store dfa states as a linked list
@@ -134,6 +141,7 @@ struct dfa {
   ~dfa ();
 
   void emit (translator_output *o) const;
+  void emit_table (translator_output *o) const;
   void emit_tagsave (translator_output *o, std::string tag_states,
                      std::string tag_vals, std::string tag_count) const;
 
@@ -148,6 +156,14 @@ private:
 std::ostream& operator << (std::ostream &o, const dfa& d);
 std::ostream& operator << (std::ostream &o, const dfa* d);
 
+/* Emits a table-driven matcher, where trans[s][c] is the next state
+   after reading byte c in state s, or -(1 + outcome) to stop and run
+   outcome_snippets[outcome]. A negative initial state stops at once. */
+void emit_table_matcher (translator_output *o,
+                         const std::vector<std::vector<int> >& trans,
+                         int initial,
+                         const std::vector<std::string>& outcome_snippets);
+
 /* Produces a dfa that runs the specified code snippets based on match
    or fail outcomes for an unanchored (by default) match of re. */
 dfa *stapregex_compile (regexp *re, const std::string& match_snippet, const std::string& fail_snippet);
@@ -460,6 +460,124 @@ str_to_re(const string& str)
   return re;
 }
 
+static const string&
+longest(const string& a, const string& b)
+{
+  return a.length() >= b.length() ? a : b;
+}
+
+regexp_literals
+required_literals(const regexp *re)
+{
+  const string type = re->type_of();
+
+  if (type == "null_op" || type == "tag_op")
+    return regexp_literals("");
+
+  if (type == "anchor_op")
+    {
+      // '^' is zero-width, but '$' actually matches the '\0', which
+      // can't be part of a C string literal.
+      regexp_literals r;
+      if (((const anchor_op *) re)->type == '^')
+        {
+          r = regexp_literals("");
+          r.anchored = true;
+        }
+      return r;
+    }
+
+  if (type == "match_op")
+    {
+      const range *ran = ((const match_op *) re)->ran;
+      if (ran->segments.size() == 1
+          && ran->segments[0].first == ran->segments[0].second
+          && ran->segments[0].first != '\0')
+        return regexp_literals(string(1, ran->segments[0].first));
+      return regexp_literals();
+    }
+
+  if (type == "cat_op")
+    {
+      regexp_literals a = required_literals(((const cat_op *) re)->a);
+      regexp_literals b = required_literals(((const cat_op *) re)->b);
+      bool anchored = (a.anchored
+                       || (a.exact && a.must.empty() && b.anchored));
+
+      regexp_literals r;
+      if (a.exact && b.exact)
+        {
+          r = regexp_literals(a.must + b.must);
+          r.anchored = anchored;
+          return r;
+        }
+
+      r.anchored = anchored;
+      r.prefix = a.exact ? a.must + b.prefix : a.prefix;
+      r.suffix = b.exact ? a.suffix + b.must : b.suffix;
+      r.must = longest(longest(a.must, b.must), a.suffix + b.prefix);
+      r.must = longest(longest(r.must, r.prefix), r.suffix);
+      return r;
+    }
+
+  if (type == "alt_op")
+    {
+      regexp_literals a = required_literals(((const alt_op *) re)->a);
+      regexp_literals b = required_literals(((const alt_op *) re)->b);
+      if (a.exact && b.exact && a.must == b.must)
+        {
+          a.anchored = a.anchored && b.anchored;
+          return a;
+        }
+
+      regexp_literals r;
+      r.anchored = a.anchored && b.anchored;
+      unsigned n = 0;
+      while (n < a.prefix.length() && n < b.prefix.length()
+             && a.prefix[n] == b.prefix[n])
+        n++;
+      r.prefix = a.prefix.substr(0, n);
+      n = 0;
+      while (n < a.suffix.length() && n < b.suffix.length()
+             && a.suffix[a.suffix.length() - n - 1]
+                == b.suffix[b.suffix.length() - n - 1])
+        n++;
+      r.suffix = a.suffix.substr(a.suffix.length() - n);
+      r.must = a.must == b.must ? a.must : longest(r.prefix, r.suffix);
+      return r;
+    }
+
+  if (type == "close_op" || type == "rule_op")
+    {
+      const regexp *sub = (type == "close_op"
+                           ? ((const close_op *) re)->re
+                           : ((const rule_op *) re)->re);
+      regexp_literals r = required_literals(sub);
+      if (type == "close_op" && r.exact && !r.must.empty())
+        r.exact = false; // -- one or more copies
+      return r;
+    }
+
+  if (type == "closev_op")
+    {
+      const closev_op *cv = (const closev_op *) re;
+      regexp_literals r = required_literals(cv->re);
+      if (cv->nmin <= 0)
+        {
+          // -- zero copies are allowed, so nothing is required
+          if (!r.exact || !r.must.empty())
+            return regexp_literals();
+          r.anchored = false;
+          return r;
+        }
+      if (r.exact && !r.must.empty())
+        r.exact = false; // -- XXX: could expand fixed repetitions
+      return r;
+    }
+
+  return regexp_literals(); // -- unknown, so assume nothing
+}
+
 regexp *
 do_alt(regexp *a, regexp *b)
 {
@@ -251,6 +251,23 @@ struct rule_op : public regexp {
 
 regexp *str_to_re(const std::string& str);
 
+/* Literal strings implied by a regexp, used to build a cheap
+   prefilter in front of the DFA. If 'exact', the regexp matches
+   exactly the string 'prefix' (== 'suffix' == 'must') and nothing
+   else. Otherwise every match starts with 'prefix', ends with
+   'suffix' and contains 'must' somewhere. Any of them may be empty.
+   If 'anchored', every match starts at the beginning of the string. */
+struct regexp_literals {
+  bool exact, anchored;
+  std::string prefix, suffix, must;
+
+  regexp_literals () : exact(false), anchored(false) {}
+  regexp_literals (const std::string& s)
+    : exact(true), anchored(false), prefix(s), suffix(s), must(s) {}
+};
+
+regexp_literals required_literals(const regexp *re);
+
 regexp *make_alt(regexp* a, regexp* b);
 regexp *make_dot(bool allow_zero = false);
 
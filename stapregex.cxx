@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include <string>
 #include <algorithm>
+#include <map>
 
 using namespace std;
 
@@ -52,6 +53,37 @@ regex_to_stapdfa (systemtap_session *s, const string& input, const token *tok)
   return dfa;
 }
 
+#ifndef STAPREGEX_SET_MAX_STATES
+#define STAPREGEX_SET_MAX_STATES 1024
+#endif
+
+stapdfa_set *
+regex_set_to_stapdfa_set (systemtap_session *s, const vector<string>& inputs,
+                          const token *tok)
+{
+  string key;
+  vector<stapdfa *> members;
+  for (unsigned i = 0; i < inputs.size(); i++)
+    {
+      key += inputs[i] + '\0';
+      members.push_back (regex_to_stapdfa (s, inputs[i], tok));
+    }
+
+  if (s->dfa_sets.find(key) != s->dfa_sets.end())
+    return s->dfa_sets[key];
+
+  stapdfa_set *set = new stapdfa_set ("__stp_dfa_set"
+                                      + lex_cast(s->dfa_counter++), members);
+  if (set->too_large())
+    {
+      delete set;
+      return NULL;
+    }
+
+  s->dfa_sets[key] = set;
+  return set;
+}
+
 // ------------------------------------------------------------------------
 
 stapdfa::stapdfa (const string& func_name, const string& re,
@@ -117,6 +149,8 @@ stapdfa::emit_declaration (translator_output *o) const
   // XXX: YYFILL is disabled as it doesn't play well with ^
   o->newline();
 
+  emit_prefilter (o);
+
   try
     {
       content->emit(o);
@@ -155,6 +189,60 @@ stapdfa::emit_declaration (translator_output *o) const
   o->newline(-1) << "}";
 }
 
+// Quote a literal for C, taking care not to produce trigraphs.
+static string
+literal_qstring (const string& lit)
+{
+  string q = lex_cast_qstring (lit);
+  string out;
+  for (unsigned i = 0; i < q.length(); i++)
+    {
+      if (q[i] == '?')
+        out += '\\';
+      out += q[i];
+    }
+  return out;
+}
+
+// Reject strings that can't possibly match before running the DFA,
+// using literals that every match must contain. The DFA has to look
+// at every character of a non-matching string, while strchr/strstr
+// are optimized string scans.
+void
+stapdfa::emit_prefilter (translator_output *o) const
+{
+  regexp_literals lit = required_literals (ast);
+  bool anchored = lit.anchored;
+
+  if (anchored && !lit.prefix.empty ())
+    {
+      o->newline() << "if (strncmp (str, " << literal_qstring (lit.prefix)
+                   << ", " << lit.prefix.length() << ") != 0)";
+      o->newline(1) << "goto match_fail;";
+      o->indent(-1);
+    }
+
+  // An anchored prefix check already covers a 'must' literal that
+  // is part of the prefix.
+  if (lit.must.empty ()
+      || (anchored && lit.prefix.find (lit.must) != string::npos))
+    return;
+
+  if (lit.must.length() == 1)
+    {
+      string q = literal_qstring (lit.must);
+      if (lit.must[0] == '\'')
+        q = "\"\\'\"";
+      o->newline() << "if (strchr (str, '" << q.substr(1, q.length() - 2)
+                   << "') == NULL)";
+    }
+  else
+    o->newline() << "if (strstr (str, " << literal_qstring (lit.must)
+                 << ") == NULL)";
+  o->newline(1) << "goto match_fail;";
+  o->indent(-1);
+}
+
 void
 stapdfa::emit_matchop_start (translator_output *o) const
 {
@@ -167,6 +255,142 @@ stapdfa::emit_matchop_end (translator_output *o) const
   o->line() << ")))";
 }
 
+// ------------------------------------------------------------------------
+
+/* The fused automaton is the product of the members' DFAs, built
+   directly from their states. Each component of a product state is
+   either a live member state (>= 0), or that member's settled
+   outcome: MEMBER_FAILED or MEMBER_MATCHED. A product state stops
+   the scan as soon as the result of the ordered tests is known. */
+
+static const int MEMBER_FAILED = -1;
+static const int MEMBER_MATCHED = -2;
+
+// Returns the result (0 for no match) or -1 if not yet known.
+static int
+product_result (const vector<int>& ps)
+{
+  for (unsigned k = 0; k < ps.size(); k++)
+    {
+      if (ps[k] == MEMBER_MATCHED)
+        return k + 1;
+      if (ps[k] >= 0)
+        return -1;
+    }
+  return 0;
+}
+
+static int
+member_outcome (const state *s)
+{
+  return s->accept_outcome ? MEMBER_MATCHED : MEMBER_FAILED;
+}
+
+stapdfa_set::stapdfa_set (const string& func_name,
+                          const vector<stapdfa *>& members)
+  : func_name(func_name), members(members), initial(-1), oversized(false)
+{
+  unsigned n = members.size();
+
+  // Per-member transition tables, indexed by state label:
+  vector<vector<vector<int> > > mtrans(n);
+  vector<int> start(n);
+  for (unsigned k = 0; k < n; k++)
+    {
+      const dfa *d = members[k]->content;
+      mtrans[k].resize(d->nstates, vector<int>(256, MEMBER_FAILED));
+      for (state *st = d->first; st; st = st->next)
+        for (list<span>::const_iterator it = st->spans.begin();
+             it != st->spans.end(); it++)
+          for (unsigned c = it->lb; c <= (unsigned) it->ub; c++)
+            mtrans[k][st->label][c] = (it->to->accepts ? member_outcome(it->to)
+                                       : (int) it->to->label);
+      start[k] = (d->first->accepts ? member_outcome(d->first)
+                  : (int) d->first->label);
+    }
+
+  int r = product_result(start);
+  if (r >= 0)
+    {
+      initial = -1 - r;
+      return;
+    }
+
+  map<vector<int>, int> index;
+  vector<vector<int> > states;
+  index[start] = 0;
+  states.push_back(start);
+  initial = 0;
+
+  for (unsigned i = 0; i < states.size(); i++)
+    {
+      // Give up early on a blowup, see regex_set_to_stapdfa_set().
+      if (states.size() > STAPREGEX_SET_MAX_STATES)
+        {
+          oversized = true;
+          trans.clear();
+          return;
+        }
+
+      trans.push_back(vector<int>(256));
+      for (unsigned c = 0; c < 256; c++)
+        {
+          vector<int> next(states[i]);
+          for (unsigned k = 0; k < n; k++)
+            if (next[k] >= 0)
+              next[k] = mtrans[k][next[k]][c];
+
+          r = product_result(next);
+          if (r >= 0)
+            {
+              trans[i][c] = -1 - r;
+              continue;
+            }
+
+          map<vector<int>, int>::iterator it = index.find(next);
+          if (it == index.end())
+            {
+              it = index.insert(make_pair(next, (int) states.size())).first;
+              states.push_back(next);
+            }
+          trans[i][c] = it->second;
+        }
+    }
+}
+
+void
+stapdfa_set::emit_declaration (translator_output *o) const
+{
+  o->newline() << "// DFA for";
+  for (unsigned k = 0; k < members.size(); k++)
+    o->line() << " \"" << members[k]->orig_input << "\"";
+  o->newline() << "int " << func_name << " (struct context * __restrict__ c, const char *str) {";
+  o->indent(1);
+  o->newline() << "const char *cur = str;";
+  o->newline() << "#define YYCURSOR cur";
+
+  vector<string> outcomes;
+  for (unsigned k = 0; k <= members.size(); k++)
+    outcomes.push_back("return " + lex_cast(k) + ";");
+  emit_table_matcher (o, trans, initial, outcomes);
+
+  o->newline() << "#undef YYCURSOR";
+  o->newline() << "return 0;";
+  o->newline(-1) << "}";
+}
+
+void
+stapdfa_set::emit_matchop_start (translator_output *o) const
+{
+  o->line() << func_name << "(c, ("; // XXX: assumes context is available
+}
+
+void
+stapdfa_set::emit_matchop_end (translator_output *o) const
+{
+  o->line() << "))";
+}
+
 void
 stapdfa::print (std::ostream& o) const
 {
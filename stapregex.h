@@ -15,6 +15,7 @@
 #define STAPREGEX_H
 
 #include <string>
+#include <vector>
 #include <iostream>
 
 struct systemtap_session; /* from session.h */
@@ -44,6 +45,10 @@ struct stapdfa {
   void print(translator_output *o) const;
   void print(std::ostream& o) const;
 private:
+  friend struct stapdfa_set;
+
+  void emit_prefilter (translator_output *o) const;
+
   stapregex::regexp *ast;
   stapregex::dfa *content;
   bool do_tag;
@@ -51,10 +56,39 @@ private:
 
 std::ostream& operator << (std::ostream &o, const stapdfa& d);
 
+/* Several regexes tried in order against the same string, as in an
+   if/else-if chain, fused into a single scan. The emitted function
+   returns the (1-based) index of the first regex that matches, or 0
+   if none does. */
+struct stapdfa_set {
+  std::string func_name;
+  std::vector<stapdfa *> members;
+
+  stapdfa_set (const std::string& func_name,
+               const std::vector<stapdfa *>& members);
+  unsigned num_states() const { return trans.size(); }
+  bool too_large() const { return oversized; }
+
+  void emit_declaration (translator_output *o) const;
+  void emit_matchop_start (translator_output *o) const;
+  void emit_matchop_end (translator_output *o) const;
+private:
+  // Product automaton: next state per byte, or -(1 + result).
+  std::vector<std::vector<int> > trans;
+  int initial;
+  bool oversized;
+};
+
 /* Creates a dfa if no dfa for the corresponding regex exists yet;
    retrieves the corresponding dfa from s->dfas if already there: */
 stapdfa *regex_to_stapdfa (systemtap_session *s, const std::string& input, const token* tok);
 
+/* Likewise for a fused set of regexes; returns NULL if the combined
+   automaton would be too large to be worth it: */
+stapdfa_set *regex_set_to_stapdfa_set (systemtap_session *s,
+                                       const std::vector<std::string>& inputs,
+                                       const token* tok);
+
 #endif
 
 /* vim: set sw=2 ts=8 cino=>4,n-2,{2,^-2,t0,(0,u0,w1,M1 : */
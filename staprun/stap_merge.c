@@ -20,40 +20,195 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+/*
+ * Each per-cpu input is a sequence of records, a struct _stp_trace
+ * header (a global sequence number and the payload length) followed by
+ * the payload.  The inputs are mmap'd and merged through a min-heap
+ * keyed on the sequence number of each input's next record, so merging
+ * is O(records * log(cpus)) and the payload is written straight out of
+ * the mapping.
+ */
 
 static void usage (char *prog)
 {
-	fprintf(stderr, "%s [-v] [-o output_filename] input_files ...\n", prog);
+	fprintf(stderr, "%s [-v] [-f] [-o output_filename] input_files ...\n", prog);
 	exit(-1);
 }
 
-#define TIMESTAMP_SIZE (sizeof(int))
-#define NR_CPUS 256
+#define HEADER_SIZE (2 * sizeof(uint32_t))
 
-int main (int argc, char *argv[])
+/* In follow mode, how long to sleep when no input has new data, and
+   after how many idle polls a gap in the sequence numbers is taken to
+   be a drop rather than a record that has not been written yet. */
+#define FOLLOW_POLL_USEC 100000
+#define FOLLOW_GAP_POLLS 10
+
+enum { INPUT_READY, INPUT_PENDING, INPUT_DONE };
+
+struct input {
+	const char *name;
+	int fd;
+	unsigned char *data;	/* mmap'd file contents */
+	size_t size;		/* bytes mapped */
+	size_t pos;		/* offset of the next record */
+	uint32_t seq;		/* sequence number of the next record */
+	uint32_t len;		/* payload length of the next record */
+};
+
+static struct input *inputs;
+static int ninputs;
+static int *heap;		/* min-heap of ready input indices */
+static int heap_size;
+static int follow;
+static volatile sig_atomic_t stop_following;
+
+static void stop_handler (int sig)
 {
-	char *buf, *outfile_name = NULL;
-	int c, i, j, rc, dropped=0;
-	long count=0, min, num[NR_CPUS] = { 0 };
-	FILE *ofp = NULL;
-	FILE *fp[NR_CPUS] = { 0 };
-	int ncpus, len, verbose = 0;
-	int bufsize = 65536;
+	(void) sig;
+	stop_following = 1;
+}
 
-	buf = malloc(bufsize);
-	if (buf == NULL) {
-		fprintf(stderr, "Memory allocation failed.\n");
-		exit(-2);
+static int input_less (int a, int b)
+{
+	return inputs[a].seq < inputs[b].seq;
+}
+
+static void heap_push (int i)
+{
+	int n = heap_size++;
+	while (n > 0) {
+		int parent = (n - 1) / 2;
+		if (!input_less(i, heap[parent]))
+			break;
+		heap[n] = heap[parent];
+		n = parent;
+	}
+	heap[n] = i;
+}
+
+static int heap_pop (void)
+{
+	int top = heap[0];
+	int last = heap[--heap_size];
+	int n = 0;
+
+	for (;;) {
+		int child = 2 * n + 1;
+		if (child >= heap_size)
+			break;
+		if (child + 1 < heap_size && input_less(heap[child + 1], heap[child]))
+			child++;
+		if (!input_less(heap[child], last))
+			break;
+		heap[n] = heap[child];
+		n = child;
+	}
+	if (heap_size > 0)
+		heap[n] = last;
+	return top;
+}
+
+/* (Re)map the input if the file has grown.  Returns 1 if more data
+   became available, 0 if not, -1 on error. */
+static int input_map (struct input *in)
+{
+	struct stat st;
+	void *data;
+
+	if (fstat(in->fd, &st) < 0) {
+		fprintf(stderr, "ERROR: couldn't stat %s: %s\n", in->name, strerror(errno));
+		return -1;
+	}
+	if ((size_t) st.st_size <= in->size)
+		return 0;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "ERROR: couldn't mmap %s: %s\n", in->name, strerror(errno));
+		return -1;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	if (in->data)
+		munmap(in->data, in->size);
+	in->data = data;
+	in->size = st.st_size;
+	return 1;
+}
+
+/* Decode the header of the next record of the input. */
+static int input_next (struct input *in)
+{
+	uint32_t hdr[2];
+
+	if (in->size - in->pos < HEADER_SIZE)
+		goto incomplete;
+	memcpy(hdr, in->data + in->pos, HEADER_SIZE);
+	if (hdr[0] == 0)
+		return INPUT_DONE;
+	if (in->size - in->pos - HEADER_SIZE < hdr[1])
+		goto incomplete;
+	in->seq = hdr[0];
+	in->len = hdr[1];
+	return INPUT_READY;
+
+incomplete:
+	if (follow && !stop_following)
+		return INPUT_PENDING;
+	if (in->pos != in->size)
+		fprintf(stderr, "warning: %s ends with a truncated record\n", in->name);
+	return INPUT_DONE;
+}
+
+/* Pick up new data of inputs that ran dry.  Returns the number of
+   inputs that became ready, or -1 on error. */
+static int poll_pending (char *pending)
+{
+	int i, found = 0;
+
+	for (i = 0; i < ninputs; i++) {
+		int rc;
+		if (!pending[i])
+			continue;
+		if (input_map(&inputs[i]) < 0)
+			return -1;
+		rc = input_next(&inputs[i]);
+		if (rc == INPUT_PENDING)
+			continue;
+		pending[i] = 0;
+		if (rc == INPUT_READY) {
+			heap_push(i);
+			found++;
+		}
 	}
+	return found;
+}
+
+int main (int argc, char *argv[])
+{
+	char *outfile_name = NULL;
+	char *pending;
+	int c, i, dropped = 0, idle = 0, verbose = 0;
+	long count = 0;
+	FILE *ofp = NULL;
 
-	while ((c = getopt (argc, argv, "vo:")) != EOF)  {
+	while ((c = getopt (argc, argv, "vfo:")) != EOF)  {
 		switch (c) {
 		case 'v':
 			verbose = 1;
 			break;
+		case 'f':
+			follow = 1;
+			break;
 		case 'o':
 			outfile_name = optarg;
 			break;
@@ -61,24 +216,55 @@ int main (int argc, char *argv[])
 			usage(argv[0]);
 		}
 	}
-	
+
 	if (optind == argc)
 		usage (argv[0]);
 
-	i = 0;
-	while (optind < argc) {
-		fp[i] = fopen(argv[optind++], "r");
-		if (!fp[i]) {
-			fprintf(stderr, "error opening file %s.\n", argv[optind - 1]);
+	ninputs = argc - optind;
+	inputs = calloc(ninputs, sizeof(*inputs));
+	heap = calloc(ninputs, sizeof(*heap));
+	pending = calloc(ninputs, 1);
+	if (inputs == NULL || heap == NULL || pending == NULL) {
+		fprintf(stderr, "Memory allocation failed.\n");
+		exit(-2);
+	}
+
+	/* Following keeps every input open, make room for all of them. */
+	if (follow) {
+		struct rlimit rl;
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0
+		    && rl.rlim_cur < (rlim_t) ninputs + 16) {
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
+		}
+		signal(SIGINT, stop_handler);
+		signal(SIGTERM, stop_handler);
+	}
+
+	for (i = 0; i < ninputs; i++) {
+		struct input *in = &inputs[i];
+		int rc;
+
+		in->name = argv[optind + i];
+		in->fd = open(in->name, O_RDONLY);
+		if (in->fd < 0) {
+			fprintf(stderr, "error opening file %s.\n", in->name);
 			return -1;
 		}
-		if (fread (buf, TIMESTAMP_SIZE, 1, fp[i]))
-			num[i] = *((int *)buf);
-		else
-			num[i] = 0;
-		i++;
+		if (input_map(in) < 0)
+			return -1;
+		if (!follow) {
+			/* The mapping stays valid, don't hold on to
+			   thousands of descriptors. */
+			close(in->fd);
+			in->fd = -1;
+		}
+		rc = input_next(in);
+		if (rc == INPUT_READY)
+			heap_push(i);
+		else if (rc == INPUT_PENDING)
+			pending[i] = 1;
 	}
-	ncpus = i;
 
 	if (!outfile_name)
 		ofp = stdout;
@@ -90,54 +276,86 @@ int main (int argc, char *argv[])
 			return -1;
 		}
 	}
-	
-	do {
-		min = num[0];
-		j = 0;
-		for (i = 1; i < ncpus; i++) {
-			if (min == 0 || (num[i] && num[i] < min)) {
-				min = num[i];
-				j = i;
-			}
-		}
+	setvbuf(ofp, NULL, _IOFBF, 1 << 20);
+
+	for (;;) {
+		struct input *in;
+		int j, rc;
 
-		if (fread(&len, sizeof(int), 1, fp[j])) {
-			if (verbose)
-				fprintf(stdout, "[CPU:%d, seq=%ld, length=%d]\n", j, min, len);
-			if (len > bufsize) {
-				bufsize = len;
-				if (verbose) fprintf(stderr, "reallocating %d bytes\n", bufsize);
-				buf = realloc(buf, bufsize);
-				if (buf == NULL) {
-					fprintf(stderr, "Memory allocation failed.\n");	
-					exit(-2);
+		if (follow) {
+			/* A record may only go out once every record before
+			   it has, which can still be on its way into another
+			   input.  Wait a while for it before calling it a
+			   drop.  Once told to stop, drain what is there,
+			   remapping every input as a poll would, since the
+			   last records may have come in since. */
+			if (stop_following) {
+				for (i = 0; i < ninputs; i++) {
+					if (input_map(&inputs[i]) < 0)
+						return -1;
+					if (pending[i]) {
+						pending[i] = 0;
+						if (input_next(&inputs[i]) == INPUT_READY)
+							heap_push(i);
+					}
 				}
+				follow = 0;
+				continue;
 			}
-			if ((rc = fread(buf, len, 1, fp[j])) <= 0 ) {
-				fprintf(stderr, "fread error: got %d\n", rc);
-				exit(-3);
-			}
-			if ((rc = fwrite(buf, len, 1, ofp)) <= 0 ) {
-				fprintf(stderr, "fread error: got %d\n", rc);
-				exit(-3);
+			if (heap_size == 0 && memchr(pending, 1, ninputs) == NULL)
+				break;
+			if (heap_size == 0 || inputs[heap[0]].seq != count + 1) {
+				rc = poll_pending(pending);
+				if (rc < 0)
+					return -1;
+				if (rc == 0 && (heap_size == 0 || ++idle < FOLLOW_GAP_POLLS)) {
+					fflush(ofp);
+					usleep(FOLLOW_POLL_USEC);
+					continue;
+				}
+				if (rc > 0)
+					continue;
 			}
+			idle = 0;
 		}
 
-		if (min && ++count != min) {
-			fprintf(stderr, "got %ld. expected %ld\n", min, count);
-			dropped += min - count ;
-			count = min;
+		if (heap_size == 0)
+			break;
+
+		j = heap_pop();
+		in = &inputs[j];
+
+		if (verbose)
+			fprintf(stdout, "[CPU:%d, seq=%u, length=%u]\n", j, in->seq, in->len);
+		if (in->len && fwrite(in->data + in->pos + HEADER_SIZE, in->len, 1, ofp) != 1) {
+			fprintf(stderr, "fwrite error: %s\n", strerror(errno));
+			exit(-3);
 		}
 
-		if (fread (buf, TIMESTAMP_SIZE, 1, fp[j]))
-			num[j] = *((int *)buf);
-		else
-			num[j] = 0;
-	} while (min);
+		if (++count != in->seq) {
+			fprintf(stderr, "got %u. expected %ld\n", in->seq, count);
+			dropped += in->seq - count ;
+			count = in->seq;
+		}
+
+		in->pos += HEADER_SIZE + in->len;
+		rc = input_next(in);
+		if (rc == INPUT_READY)
+			heap_push(j);
+		else if (rc == INPUT_PENDING)
+			pending[j] = 1;
+	}
 
-	for (i = 0; i < ncpus; i++)
-		fclose (fp[i]);
+	for (i = 0; i < ninputs; i++) {
+		if (inputs[i].data)
+			munmap(inputs[i].data, inputs[i].size);
+		if (inputs[i].fd >= 0)
+			close(inputs[i].fd);
+	}
 	fclose (ofp);
+	free(pending);
+	free(heap);
+	free(inputs);
 	printf ("sequence had %d drops\n", dropped);
 	return 0;
 }
@@ -965,11 +965,17 @@ void stat_op::print (ostream& o) const
       o << "max(";
       break;
 
+    case sc_quantile:
+      o << "quantile(";
+      break;
+
     case sc_none:
       assert (0); // should not happen, as sc_none is only used in foreach sorts
       break;
     }
   stat->print(o);
+  for (size_t i = 0; i < params.size(); ++i)
+    o << ", " << params[i];
   o << ")";
 }
 
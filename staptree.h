@@ -177,6 +177,13 @@ struct regex_query: public expression
   expression* left;
   std::string op;
   literal_string* right;
+  // Set by fuse_regex_matches for =~ tests of an if/else-if chain
+  // that share one scan: fused_index is this test's 1-based position
+  // in fused_set, and only the first test of the chain runs the scan.
+  std::string fused_set;
+  unsigned fused_index;
+  bool fused_first;
+  regex_query(): left(0), right(0), fused_index(0), fused_first(false) {}
   void visit (visitor* u);
   void print (std::ostream& o) const;
 };
@@ -459,6 +466,7 @@ enum stat_component_type
     sc_sum,
     sc_min,
     sc_max,
+    sc_quantile,
     sc_none,
   };
 
@@ -466,6 +474,7 @@ struct stat_op: public expression
 {
   stat_component_type ctype;
   expression* stat;
+  std::vector<int64_t> params; // @quantile numerator and denominator
   void print (std::ostream& o) const;
   void visit (visitor* u);
 };
@@ -837,6 +837,7 @@ done
 %{_bindir}/stap-prep
 %{_bindir}/stap-report
 %dir %{_datadir}/systemtap
+%dir %attr(0755,root,root) %{_localstatedir}/cache/systemtap
 %{_datadir}/systemtap/runtime
 %{_datadir}/systemtap/tapset
 %{_mandir}/man1/stap.1*
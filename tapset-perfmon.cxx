@@ -29,6 +29,7 @@ static const string TOK_PERF("perf");
 static const string TOK_TYPE("type");
 static const string TOK_CONFIG("config");
 static const string TOK_SAMPLE("sample");
+static const string TOK_BATCH("batch");
 static const string TOK_PROCESS("process");
 static const string TOK_COUNTER("counter");
 
@@ -44,12 +45,14 @@ struct perf_derived_probe: public derived_probe
   int64_t event_type;
   int64_t event_config;
   int64_t interval;
+  int64_t batch;
   bool has_process;
   bool has_counter;
   string process_name;
   string counter;
   perf_derived_probe (probe* p, probe_point* l, int64_t type, int64_t config,
-		      int64_t i, bool pp, bool cp, string pn, string cv);
+		      int64_t i, bool pp, bool cp, string pn, string cv,
+		      int64_t b);
   virtual void join_group (systemtap_session& s);
 };
 
@@ -69,10 +72,11 @@ perf_derived_probe::perf_derived_probe (probe* p, probe_point* l,
 					bool process_p,
 					bool counter_p,
 					string process_n,
-					string counter):
+					string counter,
+					int64_t b):
   
   derived_probe (p, l, true /* .components soon rewritten */),
-  event_type (type), event_config (config), interval (i),
+  event_type (type), event_config (config), interval (i), batch (b),
   has_process (process_p), has_counter (counter_p), process_name (process_n),
   counter (counter)
 {
@@ -82,6 +86,8 @@ perf_derived_probe::perf_derived_probe (probe* p, probe_point* l,
   comps.push_back (new probe_point::component (TOK_TYPE, new literal_number(type)));
   comps.push_back (new probe_point::component (TOK_CONFIG, new literal_number (config)));
   comps.push_back (new probe_point::component (TOK_SAMPLE, new literal_number (interval)));
+  if (batch)
+    comps.push_back (new probe_point::component (TOK_BATCH, new literal_number (batch)));
   comps.push_back (new probe_point::component (TOK_PROCESS, new literal_string (process_name)));
   comps.push_back (new probe_point::component (TOK_COUNTER, new literal_string (counter)));
 }
@@ -103,6 +109,7 @@ void
 perf_derived_probe_group::emit_module_decls (systemtap_session& s)
 {
   bool have_a_process_tag = false;
+  bool have_a_batch = false;
 
   for (unsigned i=0; i < probes.size(); i++)
     if (probes[i]->has_process && !probes[i]->has_counter)
@@ -111,6 +118,10 @@ perf_derived_probe_group::emit_module_decls (systemtap_session& s)
 	break;
       }
 
+  for (unsigned i=0; i < probes.size(); i++)
+    if (probes[i]->batch)
+      have_a_batch = true;
+
   if (probes.empty()) return;
 
   s.op->newline() << "/* ---- perf probes ---- */";
@@ -119,7 +130,7 @@ perf_derived_probe_group::emit_module_decls (systemtap_session& s)
   s.op->newline();
 
   /* declarations */
-  s.op->newline() << "static void handle_perf_probe (unsigned i, struct pt_regs *regs);";
+  s.op->newline() << "static void handle_perf_probe (unsigned i, struct pt_regs *regs, struct stap_perf_batch *batch);";
   for (unsigned i=0; i < probes.size(); i++)
     {
       s.op->newline() << "#ifdef STAPCONF_PERF_HANDLER_NMI";
@@ -167,6 +178,8 @@ perf_derived_probe_group::emit_module_decls (systemtap_session& s)
                        << "{ .sample_period=" << probes[i]->interval << "ULL }},";
       s.op->newline() << ".callback=enter_perf_probe_" << i << ", ";
       s.op->newline() << ".probe=" << common_probe_init (probes[i]) << ", ";
+      if (probes[i]->batch)
+        s.op->newline() << ".batch=" << probes[i]->batch << ", ";
 
       string l_process_name;
       if (probes[i]->has_process && !probes[i]->has_counter)
@@ -219,16 +232,47 @@ perf_derived_probe_group::emit_module_decls (systemtap_session& s)
                       << "struct pt_regs *regs)";
       s.op->newline() << "#endif";
       s.op->newline() << "{";
-      s.op->newline(1) << "handle_perf_probe(" << i << ", regs);";
+      if (probes[i]->batch)
+        {
+          // Just queue the sample, until there's a batch to handle.
+          s.op->newline(1) << "struct stap_perf_batch *batch = "
+                           << "_stp_perf_batch_add(& stap_perf_probes[" << i << "], regs);";
+          s.op->newline() << "if (batch)";
+          s.op->newline(1) << "handle_perf_probe(" << i << ", regs, batch);";
+          s.op->indent(-1);
+        }
+      else
+        s.op->newline(1) << "handle_perf_probe(" << i << ", regs, NULL);";
       s.op->newline(-1) << "}";
     }
   s.op->newline();
 
-  s.op->newline() << "static void handle_perf_probe (unsigned i, struct pt_regs *regs)";
+  s.op->newline() << "static void handle_perf_probe (unsigned i, struct pt_regs *regs, struct stap_perf_batch *batch)";
   s.op->newline() << "{";
   s.op->newline(1) << "struct stap_perf_probe* stp = & stap_perf_probes [i];";
+  if (have_a_batch)
+    s.op->newline() << "unsigned n;";
   common_probe_entryfn_prologue (s, "STAP_SESSION_RUNNING", "stp->probe",
 				 "stp_probe_type_perf");
+  if (have_a_batch)
+    {
+      // A batch runs the handler once per queued sample, with the sample
+      // in c->ips instead of any registers, all under this one prologue.
+      // NB: that includes the one MAXACTION budget it set, which the
+      // whole batch shares, so a batch is bounded like any other probe.
+      s.op->newline() << "if (batch) {";
+      s.op->newline(1) << "c->perf_sample_p = 1;";
+      s.op->newline() << "for (n = 0; n < batch->len; n++) {";
+      s.op->newline(1) << "c->ips.perf_sample = batch->samples[n];";
+      s.op->newline() << "(*stp->probe->ph) (c);";
+      s.op->newline() << "if (c->last_error)";
+      s.op->newline(1) << "break;";
+      s.op->newline(-2) << "}";
+      s.op->newline() << "c->perf_sample_p = 0;";
+      s.op->newline() << "batch->len = 0;";
+      s.op->newline() << "goto probe_epilogue;";
+      s.op->newline(-1) << "}";
+    }
   s.op->newline() << "if (user_mode(regs)) {";
   s.op->newline(1)<< "c->user_mode_p = 1;";
   s.op->newline() << "c->uregs = regs;";
@@ -238,6 +282,18 @@ perf_derived_probe_group::emit_module_decls (systemtap_session& s)
 
   s.op->newline() << "(*stp->probe->ph) (c);";
   common_probe_entryfn_epilogue (s, true);
+  if (have_a_batch)
+    {
+      // If the prologue bailed, the batch never ran.  It has to start
+      // over anyway, or it would stay full and never be drained, so its
+      // samples are dropped; the prologue counted one of them as a
+      // skipped probe (if it was one), so count the rest too.
+      s.op->newline() << "if (batch && batch->len) {";
+      s.op->newline(1) << "if (atomic_read (session_state()) == STAP_SESSION_RUNNING)";
+      s.op->newline(1) << "atomic_add (batch->len - 1, skipped_count());";
+      s.op->newline(-1) << "batch->len = 0;";
+      s.op->newline(-1) << "}";
+    }
   s.op->newline(-1) << "}";
   s.op->newline();
   s.op->newline() << "#include \"linux/perf.c\"";
@@ -346,6 +402,13 @@ perf_builder::build(systemtap_session & sess,
   else if (period < 1)
     throw SEMANTIC_ERROR(_("invalid perf sample period ") + lex_cast(period),
                          parameters.find(TOK_SAMPLE)->second->tok);
+
+  // NB: the upper bound is STP_PERF_MAX_BATCH in runtime/linux/perf.h,
+  // which keeps each cpu's queue within one percpu allocation.
+  int64_t batch = 0;
+  if (get_param(parameters, TOK_BATCH, batch) && (batch < 1 || batch > 1024))
+    throw SEMANTIC_ERROR(_("invalid perf sample batch size ") + lex_cast(batch),
+                         parameters.find(TOK_BATCH)->second->tok);
   bool proc_p;
   string proc_n;
   proc_p = has_null_param(parameters, TOK_PROCESS)
@@ -387,7 +450,7 @@ perf_builder::build(systemtap_session & sess,
 
   finished_results.push_back
     (new perf_derived_probe(base, location, type, config, period, proc_p,
-			    has_counter, proc_n, var));
+			    has_counter, proc_n, var, batch));
   sess.perf_counters[var] = make_pair(proc_n,finished_results.back());
 }
 
@@ -403,6 +466,7 @@ register_tapset_perf(systemtap_session& s)
   match_node* event = perf->bind_num(TOK_TYPE)->bind_num(TOK_CONFIG);
   event->bind(builder);
   event->bind_num(TOK_SAMPLE)->bind(builder);
+  event->bind_num(TOK_SAMPLE)->bind_num(TOK_BATCH)->bind(builder);
   event->bind_str(TOK_PROCESS)->bind(builder);
   event->bind(TOK_PROCESS)->bind(builder);
   event->bind_str(TOK_COUNTER)->bind(builder);
@@ -26,6 +26,7 @@ static const string TOK_READ("read");
 static const string TOK_WRITE("write");
 static const string TOK_MAXSIZE("maxsize");
 static const string TOK_UMASK("umask");
+static const string TOK_CACHE("cache");
 
 
 // ------------------------------------------------------------------------
@@ -40,9 +41,10 @@ struct procfs_derived_probe: public derived_probe
   bool target_symbol_seen;
   int64_t maxsize_val;
   int64_t umask; 
+  int64_t cache_ms;
 
 
-  procfs_derived_probe (systemtap_session &, probe* p, probe_point* l, string ps, bool w, int64_t m, int64_t umask); 
+  procfs_derived_probe (systemtap_session &, probe* p, probe_point* l, string ps, bool w, int64_t m, int64_t umask, int64_t cache_ms); 
   void join_group (systemtap_session& s);
 };
 
@@ -94,9 +96,9 @@ struct procfs_var_expanding_visitor: public var_expanding_visitor
 
 procfs_derived_probe::procfs_derived_probe (systemtap_session &s, probe* p,
                                             probe_point* l, string ps, bool w,
-					    int64_t m, int64_t umask):  
+					    int64_t m, int64_t umask, int64_t cache_ms):  
     derived_probe(p, l), path(ps), write(w), target_symbol_seen(false),
-    maxsize_val(m), umask(umask) 
+    maxsize_val(m), umask(umask), cache_ms(cache_ms) 
 {
   // Expand local variables in the probe body
   procfs_var_expanding_visitor v (s, name, path, write); 
@@ -162,6 +164,10 @@ procfs_derived_probe_group::enroll (procfs_derived_probe* p)
       pset->read_probe = p;
       has_read_probes = true;
     }
+
+  // A cached file is only ever read, by many readers at once.
+  if (pset->read_probe && pset->read_probe->cache_ms && pset->write_probe)
+    throw SEMANTIC_ERROR(_("a cached read procfs probe cannot share its procfs path \"") + p->path + _("\" with a write probe"));
 }
 
 
@@ -251,6 +257,9 @@ procfs_derived_probe_group::emit_module_decls (systemtap_session& s)
       else
 	s.op->line() << " .bufsize=MAXSTRINGLEN,";
 
+      if (pset->read_probe != NULL && pset->read_probe->cache_ms)
+        s.op->line() << " .cache_ms=" << pset->read_probe->cache_ms << ",";
+
        s.op->line() << " .permissions=" << (((pset->read_probe ? 0444 : 0) 
 					 | (pset->write_probe ? 0222 : 0)) &~ 
 					   ((pset->read_probe ? pset->read_probe->umask : 0) 
@@ -380,7 +389,7 @@ procfs_derived_probe_group::emit_module_init (systemtap_session& s)
   s.op->indent(-1);
 
   s.op->newline() << "_spp_init(spp);";
-  s.op->newline() << "rc = _stp_create_procfs(spp->path, i, &_stp_proc_fops, spp->permissions, spp);";
+  s.op->newline() << "rc = _stp_create_procfs(spp->path, i, spp->cache_ms ? &_stp_proc_cached_fops : &_stp_proc_fops, spp->permissions, spp);";
 
   s.op->newline() << "if (rc) {";
   s.op->newline(1) << "_stp_close_procfs();";
@@ -573,6 +582,14 @@ procfs_builder::build(systemtap_session & sess,
 	throw SEMANTIC_ERROR (_("maxsize must be greater than 0"));
     }
 
+  // Validate '.cache(MS)', if it exists.
+  int64_t cache_ms = 0;
+  if (get_param(parameters, TOK_CACHE, cache_ms))
+    {
+      if (cache_ms <= 0 || cache_ms > 0x7fffffff)
+	throw SEMANTIC_ERROR (_("cache time must be greater than 0 ms"));
+    }
+
   // If no procfs path, default to "command".  The runtime will do
   // this for us, but if we don't do it here, we'll think the
   // following 2 probes are attached to different paths:
@@ -620,7 +637,7 @@ procfs_builder::build(systemtap_session & sess,
 
   finished_results.push_back(new procfs_derived_probe(sess, base, location,
                                                       path, has_write,
-						      maxsize_val, umask_val));
+						      maxsize_val, umask_val, cache_ms));
 }
 
 
@@ -639,6 +656,15 @@ register_tapset_procfs(systemtap_session& s)
   root->bind_str(TOK_PROCFS)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind(builder);
   root->bind_str(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind(builder);
 
+  root->bind(TOK_PROCFS)->bind(TOK_READ)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_READ)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind(TOK_PROCFS)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind_str(TOK_PROCFS)->bind(TOK_READ)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind_str(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_READ)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind_str(TOK_PROCFS)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind_num(TOK_CACHE)->bind(builder);
+  root->bind_str(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_READ)->bind_num(TOK_MAXSIZE)->bind_num(TOK_CACHE)->bind(builder);
+
   root->bind(TOK_PROCFS)->bind(TOK_WRITE)->bind(builder);
   root->bind(TOK_PROCFS)->bind_num(TOK_UMASK)->bind(TOK_WRITE)->bind(builder);
   root->bind_str(TOK_PROCFS)->bind(TOK_WRITE)->bind(builder);
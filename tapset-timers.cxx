@@ -216,6 +216,10 @@ struct hrtimer_derived_probe: public derived_probe
 
 struct hrtimer_derived_probe_group: public generic_dpg<hrtimer_derived_probe>
 {
+  // Whether to run all the probes off a single kernel hrtimer.
+  bool use_wheel (systemtap_session& s)
+    { return !s.runtime_usermode_p() && probes.size() > 1; }
+
 public:
   void emit_module_decls (systemtap_session& s);
   void emit_module_init (systemtap_session& s);
@@ -238,6 +242,8 @@ hrtimer_derived_probe_group::emit_module_decls (systemtap_session& s)
   if (probes.empty()) return;
 
   s.op->newline() << "/* ---- hrtimer probes ---- */";
+  if (use_wheel (s))
+    s.op->newline() << "#define STP_HRTIMER_WHEEL 1";
   s.op->newline() << "#include \"timer.c\"";
   s.op->newline() << "static struct stap_hrtimer_probe stap_hrtimer_probes [" << probes.size() << "] = {";
 
@@ -253,7 +259,19 @@ hrtimer_derived_probe_group::emit_module_decls (systemtap_session& s)
   s.op->newline(-1) << "};";
   s.op->newline();
 
-  if (!s.runtime_usermode_p())
+  if (use_wheel (s))
+    {
+      // The wheel timer itself is in the runtime; it only needs a way
+      // to run each probe that is due.
+      s.op->newline() << "static void _stp_hrtimer_run_probe (struct stap_hrtimer_probe *stp) {";
+      s.op->indent(1);
+      common_probe_entryfn_prologue (s, "STAP_SESSION_RUNNING", "stp->probe",
+				     "stp_probe_type_hrtimer");
+      s.op->newline() << "(*stp->probe->ph) (c);";
+      common_probe_entryfn_epilogue (s, true);
+      s.op->newline(-1) << "}";
+    }
+  else if (!s.runtime_usermode_p())
     {
       s.op->newline() << "static hrtimer_return_t _stp_hrtimer_notify_function (struct hrtimer *timer) {";
 
@@ -307,6 +325,14 @@ hrtimer_derived_probe_group::emit_module_init (systemtap_session& s)
   if (probes.empty()) return;
 
   s.op->newline() << "_stp_hrtimer_init();";
+  if (use_wheel (s))
+    {
+      s.op->newline() << "probe_point = stap_hrtimer_probes[0].probe->pp;";
+      s.op->newline() << "rc = _stp_hrtimer_wheel_create(stap_hrtimer_probes, "
+                      << probes.size() << ", _stp_hrtimer_run_probe);";
+      return;
+    }
+
   s.op->newline() << "for (i=0; i<" << probes.size() << "; i++) {";
   s.op->newline(1) << "struct stap_hrtimer_probe* stp = & stap_hrtimer_probes [i];";
   s.op->newline() << "probe_point = stp->probe->pp;";
@@ -331,6 +357,12 @@ hrtimer_derived_probe_group::emit_module_exit (systemtap_session& s)
 {
   if (probes.empty()) return;
 
+  if (use_wheel (s))
+    {
+      s.op->newline() << "_stp_hrtimer_wheel_cancel();";
+      return;
+    }
+
   s.op->newline() << "for (i=0; i<" << probes.size() << "; i++)";
   s.op->indent(1);
   s.op->newline() << "_stp_hrtimer_cancel(& stap_hrtimer_probes[i]);";
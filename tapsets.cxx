@@ -879,6 +879,7 @@ struct dwarf_builder: public derived_probe_builder
   {
     dwarf_build_no_more (s.verbose > 3);
     delete_session_module_cache (s);
+    finish_typequeries (s);
   }
 
   ~dwarf_builder()
@@ -4043,41 +4044,113 @@ dwarf_cast_query::handle_query_module()
 }
 
 
+// Is this a "<path/to/header>" or "kernel<path/to/header>" module, which
+// needs a typequery module built for it?
+static bool
+is_typequery_module(const string& module)
+{
+  return (!module.empty() && module[module.size() - 1] == '>' &&
+          (module[0] == '<' || startswith(module, "kernel<")));
+}
+
+
+// Find an existing cached build of a typequery module.  The per-user
+// cache path is returned in cached_module either way.
+static string
+find_cached_typequery(systemtap_session& s, const string& module,
+                      string& cached_module)
+{
+  if (!s.use_cache)
+    return "";
+
+  cached_module = find_typequery_hash(s, module);
+  string system_module = find_system_cache_file(s, cached_module);
+  if (!system_module.empty())
+    return system_module;
+
+  if (!cached_module.empty() && !s.poison_cache)
+    {
+      int fd = open(cached_module.c_str(), O_RDONLY);
+      if (fd != -1)
+        {
+          close(fd);
+          return cached_module;
+        }
+    }
+  return "";
+}
+
+
 void dwarf_cast_expanding_visitor::filter_special_modules(string& module)
 {
   // look for "<path/to/header>" or "kernel<path/to/header>"
   // for those cases, build a module including that header
-  if (module[module.size() - 1] == '>' &&
-      (module[0] == '<' || startswith(module, "kernel<")))
+  if (is_typequery_module(module))
     {
       string cached_module;
-      if (s.use_cache)
+      string found = find_cached_typequery(s, module, cached_module);
+      if (!found.empty())
         {
-          // see if the cached module exists
-          cached_module = find_typequery_hash(s, module);
-          if (!cached_module.empty() && !s.poison_cache)
-            {
-              int fd = open(cached_module.c_str(), O_RDONLY);
-              if (fd != -1)
-                {
-                  if (s.verbose > 2)
-                    //TRANSLATORS: Here we're using a cached module.
-                    clog << _("Pass 2: using cached ") << cached_module << endl;
-                  module = cached_module;
-                  close(fd);
-                  return;
-                }
-            }
+          if (s.verbose > 2)
+            //TRANSLATORS: Here we're using a cached module.
+            clog << _("Pass 2: using cached ") << found << endl;
+          module = found;
+          return;
         }
 
       // no cached module, time to make it
       if (make_typequery(s, module) == 0)
         {
           // try to save typequery in the cache
-          if (s.use_cache)
-            copy_file(module, cached_module, s.verbose > 2);
+          if (s.use_cache && copy_file(module, cached_module, s.verbose > 2))
+            update_system_cache(s, cached_module);
+        }
+    }
+}
+
+
+// Collects the typequery modules that the @casts of a file will need.
+struct typequery_module_collector: public traversing_visitor
+{
+  systemtap_session& s;
+  set<string> seen;
+  vector<string> modules;
+
+  typequery_module_collector(systemtap_session& s): s(s) {}
+
+  void visit_cast_op (cast_op* e)
+    {
+      traversing_visitor::visit_cast_op (e);
+
+      vector<string> alternatives;
+      tokenize(e->module, alternatives, ":");
+      for (unsigned i = 0; i < alternatives.size(); ++i)
+        {
+          const string& module = alternatives[i];
+          if (!is_typequery_module(module) || !seen.insert(module).second)
+            continue;
+
+          string cached_module;
+          if (find_cached_typequery(s, module, cached_module).empty())
+            modules.push_back(module);
         }
     }
+};
+
+
+void
+start_cast_typequeries(systemtap_session& s, stapfile* f)
+{
+  // Kick off the uncached typequery builds for the whole file at once,
+  // so they run concurrently while its probes are being derived.
+  typequery_module_collector c(s);
+  for (unsigned i = 0; i < f->probes.size(); ++i)
+    f->probes[i]->body->visit (&c);
+  for (unsigned i = 0; i < f->functions.size(); ++i)
+    f->functions[i]->body->visit (&c);
+
+  if (!c.modules.empty())
+    start_typequeries(s, c.modules);
 }
 
 
@@ -10219,8 +10292,11 @@ tracepoint_builder::get_tracequery_modules(systemtap_session& s,
   if (s.use_cache && !s.poison_cache)
     for (size_t i=0; i<headers.size(); i++)
       {
-        // see if the cached module exists
-        const string& tracequery_path = headers_cache_obj[headers[i]];
+        // see if the cached module exists, preferably prebuilt system-wide
+        string tracequery_path = headers_cache_obj[headers[i]];
+        string system_path = find_system_cache_file(s, tracequery_path);
+        if (!system_path.empty())
+          tracequery_path = system_path;
         if (!tracequery_path.empty() && file_exists(tracequery_path))
           {
             if (s.verbose > 2)
@@ -10320,6 +10396,7 @@ tracepoint_builder::get_tracequery_modules(systemtap_session& s,
         else
           // cache an empty file for failures
           copy_file("/dev/null", tracequery_path, s.verbose > 2);
+        update_system_cache(s, tracequery_path);
       }
 }
 
@@ -37,6 +37,8 @@ void register_tapset_java(systemtap_session& sess);
 std::string path_remove_sysroot(const systemtap_session& sess,
 				const std::string& path);
 
+void start_cast_typequeries(systemtap_session& s, stapfile* f);
+
 // ------------------------------------------------------------------------
 // Generic derived_probe_group: contains an ordinary vector of the
 // given type.  It provides only the enrollment function.
@@ -0,0 +1,41 @@
+struct leaf
+{
+  int d0;
+  long pad;
+  int d;
+};
+
+struct inner
+{
+  char tag;
+  struct leaf *leafp;
+};
+
+struct mid
+{
+  int x;
+  struct inner c;
+};
+
+struct top
+{
+  struct mid b;
+  long y;
+  struct mid b2;
+};
+
+static struct leaf leaf1 = { 11, 0, 12 };
+static struct leaf leaf2 = { 21, 0, 22 };
+static struct top top = { { 1, { 'b', &leaf1 } }, 2, { 3, { 'c', &leaf2 } } };
+
+void __attribute__((noinline)) sub(struct top *a)
+{
+  asm volatile ("" : : "r" (a) : "memory");
+}
+
+int
+main (void)
+{
+  sub(&top);
+  return 0;
+}
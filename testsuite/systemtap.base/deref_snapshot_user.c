@@ -0,0 +1,21 @@
+struct snap
+{
+  int a;
+  char pad[13];
+  long b;
+  short c[3];
+};
+
+static struct snap snap = { 42, "padding", -7L, { 1, -2, 3 } };
+
+void __attribute__((noinline)) sub(struct snap *s)
+{
+  asm volatile ("" : : "r" (s) : "memory");
+}
+
+int
+main (void)
+{
+  sub(&snap);
+  return 0;
+}
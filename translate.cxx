@@ -77,6 +77,12 @@ struct c_unparser: public unparser, public visitor
 
   map<string, string> probe_contents;
 
+  // Printed probe bodies, for the duplicate elimination hashes.  Probes
+  // often share one body object (see share_probe_bodies), so print it
+  // only once.
+  map<statement*, string> probe_body_prints;
+  const string& probe_body_print (derived_probe* dp);
+
   map<pair<bool, string>, string> compiled_printfs;
 
   c_unparser (systemtap_session* ss):
@@ -391,6 +397,7 @@ public:
 	assert(hop.htype == hist_log);
 	assert(hop.params.size() == 0);
 	break;
+      case statistic_decl::quantile:
       case statistic_decl::none:
 	assert(false);
       }
@@ -433,6 +440,39 @@ public:
     return "(" + value() + "->hist.buckets)";
   }
 
+  // Update the stat, maintaining only what the script extracts.  The
+  // histogram shape is spelled out as constants so the C compiler can
+  // drop the unused paths and strength-reduce the linear division.
+  string stat_add (tmpvar const & val) const;
+
+  // The size of the histogram buckets that go with each stat_data.
+  string hist_buckets_size() const
+  {
+    switch (sd.type)
+      {
+      case statistic_decl::linear:
+        return "_stp_stat_calc_buckets(" + lex_cast(sd.linear_high)
+          + ", " + lex_cast(sd.linear_low)
+          + ", " + lex_cast(sd.linear_step) + ") * sizeof(int64_t)";
+      case statistic_decl::logarithmic:
+        return "HIST_LOG_BUCKETS * sizeof(int64_t)";
+      case statistic_decl::quantile:
+        return "HIST_QUANTILE_BUCKETS * sizeof(int64_t)";
+      default:
+        return "0";
+      }
+  }
+
+  // The dyninst shared memory that init() allocates; see also
+  // c_unparser::emit_module_init.
+  virtual string shm_size() const
+  {
+    if (type() == pe_stats && ! local)
+      return "_stp_stat_shm_size(sizeof(stat_data) + "
+        + hist_buckets_size() + ")";
+    return "0";
+  }
+
   string init() const
   {
     switch (type())
@@ -475,6 +515,10 @@ public:
               prefix += string("HIST_LOG");
               break;
 
+            case statistic_decl::quantile:
+              prefix += string("HIST_QUANTILE");
+              break;
+
             default:
               throw SEMANTIC_ERROR(_F("unsupported stats type for %s", value().c_str()));
             }
@@ -565,6 +609,42 @@ ostream & operator<<(ostream & o, tmpvar const & v)
   return o << v.value();
 }
 
+string
+var::stat_add (tmpvar const & val) const
+{
+  assert (ty == pe_stats);
+
+  string shape;
+  switch (sd.type)
+    {
+    case statistic_decl::none:
+      shape = "HIST_NONE, 0, 0, 0";
+      break;
+
+    case statistic_decl::logarithmic:
+      shape = "HIST_LOG, 0, 0, HIST_LOG_BUCKETS";
+      break;
+
+    case statistic_decl::quantile:
+      shape = "HIST_QUANTILE, 0, 0, HIST_QUANTILE_BUCKETS";
+      break;
+
+    case statistic_decl::linear:
+      // A bad interval fails _stp_stat_init anyway; don't divide by it.
+      if (sd.linear_step == 0)
+        return "_stp_stat_add (" + value() + ", " + val.value() + ")";
+      // NB: as in _stp_stat_calc_buckets()
+      shape = "HIST_LINEAR, " + lex_cast(sd.linear_low)
+        + ", " + lex_cast(sd.linear_step)
+        + ", " + lex_cast((sd.linear_high - sd.linear_low)
+                          / sd.linear_step + 3);
+      break;
+    }
+
+  return "_stp_stat_add_ops (" + value() + ", " + val.value()
+    + ", " + lex_cast(sd.stat_ops) + ", " + shape + ")";
+}
+
 struct aggvar
   : public var
 {
@@ -764,6 +844,18 @@ struct mapvar
     return "(" + fetch_existing_aggregate() + "->hist.buckets)";
   }
 
+  string shm_size () const
+  {
+    // See map_node in map-gen.c, which the histogram buckets follow.
+    string node = "sizeof(struct map_node_" + keysym() + ")";
+    if (type() == pe_stats)
+      node += " + " + hist_buckets_size();
+
+    return string(is_parallel() ? "_stp_pmap_shm_size (" : "_stp_map_shm_size (")
+      + (maxsize > 0 ? lex_cast(maxsize) : "MAXMAPENTRIES")
+      + ", " + node + ")";
+  }
+
   string init () const
   {
     if (local)
@@ -798,6 +890,10 @@ struct mapvar
 	  case statistic_decl::logarithmic:
 	    prefix = prefix + ", HIST_LOG";
 	    break;
+
+	  case statistic_decl::quantile:
+	    prefix = prefix + ", HIST_QUANTILE";
+	    break;
 	  }
       }
 
@@ -918,6 +1014,19 @@ ostream & operator<<(ostream & o, itervar const & v)
 
 // ------------------------------------------------------------------------
 
+const string&
+c_unparser::probe_body_print (derived_probe* dp)
+{
+  map<statement*, string>::iterator it = probe_body_prints.find (dp->body);
+  if (it != probe_body_prints.end())
+    return it->second;
+
+  ostringstream oss;
+  dp->body->print (oss);
+  return probe_body_prints[dp->body] = oss.str();
+}
+
+
 void
 c_unparser::emit_common_header ()
 {
@@ -951,7 +1060,7 @@ c_unparser::emit_common_header ()
       ostringstream oss;
       oss << "# needs_global_locks: " << dp->needs_global_locks () << endl;
       dp->print_dupe_stamp (oss);
-      dp->body->print(oss);
+      oss << probe_body_print (dp);
       // NB: dependent probe conditions *could* be listed here, but don't need to be.
       // That's because they're only dependent on the probe body, which is already
       // "hashed" in above.
@@ -1732,6 +1841,26 @@ c_unparser::emit_module_init ()
       o->newline() << "if (rc) goto out;";
   }
 
+  // For dyninst, everything below is allocated in shared memory, which
+  // has to grow (and may move) to fit.  Size it for the session with its
+  // contexts and for all the globals in one go.  Should this fall short,
+  // the allocations still grow it as needed.
+  if (session->runtime_usermode_p())
+    {
+      o->newline() << "(void) _stp_shm_reserve (stp_session_size ()";
+      o->indent(1);
+      for (unsigned i=0; i<session->globals.size(); i++)
+        {
+          vardecl* v = session->globals[i];
+          string size = (v->index_types.size() > 0)
+            ? getmap (v).shm_size() : getvar (v).shm_size();
+          if (size != "0")
+            o->newline() << "+ " << size;
+        }
+      o->line() << ");";
+      o->indent(-1);
+    }
+
   // Now that kernel version and permissions are correct,
   // initialize the global session states before anything else.
   o->newline() << "rc = stp_session_init();";
@@ -1749,6 +1878,15 @@ c_unparser::emit_module_init ()
   o->newline(-1) << "}";
   o->newline() << "#endif";
 
+  // initialize the backtrace stack table (if needed)
+  o->newline() << "#ifdef STP_NEED_STACK_TABLE";
+  o->newline() << "rc = _stp_stack_table_init();";
+  o->newline() << "if (rc) {";
+  o->newline(1) << "_stp_error (\"couldn't initialize the stack table\");";
+  o->newline() << "goto out;";
+  o->newline(-1) << "}";
+  o->newline() << "#endif";
+
   // NB: we don't need per-_stp_module task_finders, since a single common one
   // set up in runtime/sym.c's _stp_sym_init() will scan through all _stp_modules. XXX - check this!
   o->newline() << "(void) probe_point;";
@@ -1868,6 +2006,10 @@ c_unparser::emit_module_init ()
   o->newline() << " _stp_kill_time();";  // An error is no cause to hurry...
   o->newline() << "#endif";
 
+  o->newline() << "#ifdef STP_NEED_STACK_TABLE";
+  o->newline() << "_stp_stack_table_free();";
+  o->newline() << "#endif";
+
   // Free up the context memory after an error too
   o->newline() << "_stp_runtime_contexts_free();";
 
@@ -2043,6 +2185,11 @@ c_unparser::emit_module_exit ()
   // NB: PR13386 needs to restore preemption-blocking counts
   o->newline() << "preempt_enable_no_resched();";
 
+  // The stack table may have been used for printing up to here.
+  o->newline() << "#ifdef STP_NEED_STACK_TABLE";
+  o->newline() << "_stp_stack_table_free();";
+  o->newline() << "#endif";
+
   // In dyninst mode, now we're done with the contexts, transport, everything!
   if (session->runtime_usermode_p())
     {
@@ -2180,7 +2327,7 @@ c_unparser::emit_probe (derived_probe* v)
   ostringstream oss;
 
   v->print_dupe_stamp (oss);
-  v->body->print(oss);
+  oss << probe_body_print (v);
 
   // Since the generated C changes based on whether or not the probe
   // needs locks around global variables, this needs to be reflected
@@ -2707,7 +2854,7 @@ c_unparser_assignment::c_assignop(tmpvar & res,
       assert(lval.type() == pe_stats);
       assert(rval.type() == pe_long);
       assert(res.type() == pe_long);
-      o->newline() << "_stp_stat_add (" << lval << ", " << rval << ");";
+      o->newline() << lval.stat_add (rval) << ";";
       res = rval;
     }
   else if (res.type() == pe_long)
@@ -4023,6 +4170,20 @@ c_unparser::visit_regex_query (regex_query* e)
   o->line() << "(";
   o->indent(1);
   o->newline();
+  if (e->fused_index)
+    {
+      // Part of an if/else-if chain, see fuse_regex_matches().
+      if (e->fused_first)
+        {
+          o->line() << "(c->last_regex_set = " << e->fused_set << "(c, (";
+          e->left->visit(this);
+          o->line() << "))) == " << e->fused_index;
+        }
+      else
+        o->line() << "c->last_regex_set == " << e->fused_index;
+      o->newline(-1) << ")";
+      return;
+    }
   if (e->op == "!~") o->line() << "!";
   stapdfa *dfa = session->dfas[e->right->value];
   dfa->emit_matchop_start (o);
@@ -5329,6 +5490,13 @@ c_unparser::visit_stat_op (stat_op* e)
         case sc_max:
           c_assign(res, agg.value() + "->max", e->tok);
           break;
+        case sc_quantile:
+          assert (e->params.size() == 2);
+          c_assign(res, ("_stp_stat_quantile(" + agg.value() + ", "
+                         + lex_cast(e->params[0]) + "LL, "
+                         + lex_cast(e->params[1]) + "LL)"),
+                   e->tok);
+          break;
         case sc_none:
           assert (0); // should not happen, as sc_none is only used in foreach sorts
         }
@@ -5391,6 +5559,7 @@ struct unwindsym_dump_context
   size_t eh_frame_hdr_len;
   Dwarf_Addr eh_addr;
   Dwarf_Addr eh_frame_hdr_addr;
+  bool eh_frame_hdr_synthesized; // eh_frame_hdr was malloc'd by us
 
   set<string> undone_unwindsym_modules;
 };
@@ -5499,12 +5668,228 @@ static void create_debug_frame_hdr (const unsigned char e_ident[],
     }
 }
 
+// Size of a pointer with the given DW_EH_PE encoding, zero if it
+// doesn't have a fixed size.
+static int eh_pe_size (uint8_t enc, int addr_size)
+{
+  switch (enc & 0x07)
+    {
+    case DW_EH_PE_absptr:
+      return addr_size;
+    case DW_EH_PE_udata2:
+      return 2;
+    case DW_EH_PE_udata4:
+      return 4;
+    case DW_EH_PE_udata8:
+      return 8;
+    default:
+      return 0;
+    }
+}
+
+// Find the pointer encoding used by the FDEs of the given .eh_frame
+// CIE, as given by the 'R' augmentation.  Returns false if the
+// augmentation can't be parsed.
+static bool eh_frame_fde_encoding (const Dwarf_CIE& cie, int addr_size,
+				   uint8_t *enc)
+{
+  *enc = DW_EH_PE_absptr;
+
+  const char *aug = cie.augmentation;
+  if (aug[0] != 'z')
+    return aug[0] == '\0';
+
+  const uint8_t *p = cie.augmentation_data;
+  const uint8_t *end = p + cie.augmentation_data_size;
+  for (aug++; *aug; aug++)
+    {
+      switch (*aug)
+	{
+	case 'L':
+	  p++;
+	  break;
+	case 'R':
+	  if (p >= end)
+	    return false;
+	  *enc = *p++;
+	  break;
+	case 'P':
+	  {
+	    if (p >= end)
+	      return false;
+	    int n = eh_pe_size (*p++, addr_size);
+	    if (n == 0)
+	      return false;
+	    p += n;
+	    break;
+	  }
+	case 'S':
+	  break;
+	default:
+	  return false;
+	}
+    }
+  return p <= end;
+}
+
+// Synthesize a binary search table for an .eh_frame that comes without
+// an .eh_frame_hdr, so the runtime never has to fall back to a linear
+// scan of all FDEs.  The result has the same layout as a real
+// .eh_frame_hdr, but uses absolute pointers in the same address space
+// as eh_addr, so it doesn't depend on where the header would be loaded.
+// eh_sh_addr is the unadjusted section address of the .eh_frame.
+static void create_eh_frame_hdr (const unsigned char e_ident[],
+				 Elf_Data *eh_frame,
+				 Dwarf_Addr eh_addr,
+				 Dwarf_Addr eh_sh_addr,
+				 void **eh_frame_hdr,
+				 size_t *eh_frame_hdr_len,
+				 systemtap_session& session,
+				 Dwfl_Module *mod)
+{
+  *eh_frame_hdr = NULL;
+  *eh_frame_hdr_len = 0;
+
+  int size = (e_ident[EI_CLASS] == ELFCLASS32) ? 4 : 8;
+  const uint8_t *start = (const uint8_t *) eh_frame->d_buf;
+  map<Dwarf_Off, uint8_t> cie_encodings;
+  vector< pair<Dwarf_Off, Dwarf_CFI_Entry> > fde_entries;
+  set< pair<Dwarf_Addr, Dwarf_Off> > fdes;
+  set< pair<Dwarf_Addr, Dwarf_Off> >::iterator it;
+  const char *problem = NULL;
+
+  int res = 0;
+  Dwarf_Off off = 0;
+  Dwarf_CFI_Entry entry;
+  while (res != 1 && problem == NULL)
+    {
+      Dwarf_Off next_off;
+      res = dwarf_next_cfi (e_ident, eh_frame, true, off, &next_off, &entry);
+      if (res == 0)
+	{
+	  if (entry.CIE_id == DW_CIE_ID_64)
+	    {
+	      uint8_t enc;
+	      if (eh_frame_fde_encoding (entry.cie, size, &enc))
+		cie_encodings[off] = enc;
+	      else
+		problem = "unknown CIE augmentation";
+	    }
+	  else
+	    fde_entries.push_back (make_pair (off, entry));
+	}
+      else if (res < 0)
+	problem = dwarf_errmsg (-1);
+      off = next_off;
+    }
+
+  for (unsigned i = 0; i < fde_entries.size() && problem == NULL; i++)
+    {
+      Dwarf_Off fde_off = fde_entries[i].first;
+      const Dwarf_FDE& fde = fde_entries[i].second.fde;
+      map<Dwarf_Off, uint8_t>::iterator cie = cie_encodings.find (fde.CIE_pointer);
+      if (cie == cie_encodings.end())
+	{
+	  problem = "FDE without CIE";
+	  break;
+	}
+
+      uint8_t enc = cie->second;
+      int n = eh_pe_size (enc, size);
+      if (n == 0 || fde.start + n > fde.end || (enc & DW_EH_PE_indirect))
+	{
+	  problem = "unsupported FDE pointer encoding";
+	  break;
+	}
+
+      int64_t value;
+      if (n == 2)
+	value = (enc & DW_EH_PE_signed) ? (int64_t) *((int16_t *) fde.start)
+					: (int64_t) *((uint16_t *) fde.start);
+      else if (n == 4)
+	value = (enc & DW_EH_PE_signed) ? (int64_t) *((int32_t *) fde.start)
+					: (int64_t) *((uint32_t *) fde.start);
+      else
+	value = *((int64_t *) fde.start);
+
+      Dwarf_Addr loc;
+      switch (enc & 0x70)
+	{
+	case DW_EH_PE_absptr:
+	  loc = value + (eh_addr - eh_sh_addr);
+	  break;
+	case DW_EH_PE_pcrel:
+	  loc = eh_addr + (fde.start - start) + value;
+	  break;
+	default:
+	  problem = "unsupported FDE pointer encoding";
+	  continue;
+	}
+      if (size == 4)
+	loc &= 0xffffffff;
+
+      fdes.insert(pair<Dwarf_Addr, Dwarf_Off>(loc, eh_addr + fde_off));
+    }
+
+  if (problem != NULL)
+    {
+      // Warn, but continue, backtracing will be slow...
+      if (session.verbose > 2 && ! session.suppress_warnings)
+	{
+	  const char *modname = dwfl_module_info (mod, NULL,
+						  NULL, NULL, NULL,
+						  NULL, NULL, NULL);
+	  session.print_warning("Problem creating eh frame hdr for "
+				+ lex_cast_qstring(modname)
+				+ ", " + problem);
+	}
+      return;
+    }
+
+  if (fdes.size() == 0)
+    return;
+
+  size_t total_size = 4 + (2 * size) + (2 * size * fdes.size());
+  uint8_t *hdr = (uint8_t *) malloc(total_size);
+  *eh_frame_hdr = hdr;
+  *eh_frame_hdr_len = total_size;
+
+  hdr[0] = 1; // version
+  hdr[1] = DW_EH_PE_absptr; // eh_frame_ptr encoding
+  hdr[2] = (size == 4) ? DW_EH_PE_udata4 : DW_EH_PE_udata8; // count encoding
+  hdr[3] = DW_EH_PE_absptr; // table encoding
+  if (size == 4)
+    {
+      uint32_t *table = (uint32_t *)(hdr + 4);
+      *table++ = (uint32_t) eh_addr;
+      *table++ = (uint32_t) fdes.size();
+      for (it = fdes.begin(); it != fdes.end(); it++)
+	{
+	  *table++ = (*it).first;
+	  *table++ = (*it).second;
+	}
+    }
+  else
+    {
+      uint64_t *table = (uint64_t *)(hdr + 4);
+      *table++ = (uint64_t) eh_addr;
+      *table++ = (uint64_t) fdes.size();
+      for (it = fdes.begin(); it != fdes.end(); it++)
+	{
+	  *table++ = (*it).first;
+	  *table++ = (*it).second;
+	}
+    }
+}
+
 static set<string> vdso_paths;
 
 // Get the .debug_frame end .eh_frame sections for the given module.
 // Also returns the lenght of both sections when found, plus the section
 // address (offset) of the eh_frame data. If a debug_frame is found, a
-// synthesized debug_frame_hdr is also returned.
+// synthesized debug_frame_hdr is also returned. Likewise, if there is an
+// eh_frame but no eh_frame_hdr one is synthesized, which is flagged
+// through eh_frame_hdr_synthesized.
 static void get_unwind_data (Dwfl_Module *m,
 			     void **debug_frame, void **eh_frame,
 			     size_t *debug_len, size_t *eh_len,
@@ -5514,6 +5899,7 @@ static void get_unwind_data (Dwfl_Module *m,
 			     size_t *debug_frame_hdr_len,
 			     Dwarf_Addr *debug_frame_off,
 			     Dwarf_Addr *eh_frame_hdr_addr,
+			     bool *eh_frame_hdr_synthesized,
 			     systemtap_session& session)
 {
   Dwarf_Addr start, bias = 0;
@@ -5521,6 +5907,8 @@ static void get_unwind_data (Dwfl_Module *m,
   GElf_Shdr *shdr, shdr_mem;
   Elf_Scn *scn;
   Elf_Data *data = NULL;
+  Elf_Data *eh_data = NULL;
+  Dwarf_Addr eh_sh_addr = 0;
   Elf *elf;
 
   // fetch .eh_frame info preferably from main elf file.
@@ -5539,9 +5927,10 @@ static void get_unwind_data (Dwfl_Module *m,
 	  && strcmp(scn_name, ".eh_frame") == 0
 	  && shdr->sh_type == SHT_PROGBITS)
 	{
-	  data = elf_rawdata(scn, NULL);
+	  data = eh_data = elf_rawdata(scn, NULL);
 	  *eh_frame = data->d_buf;
 	  *eh_len = data->d_size;
+	  eh_sh_addr = shdr->sh_addr;
 	  // For ".dynamic" sections we want the offset, not absolute addr.
 	  // Note we don't trust dwfl_module_relocations() for ET_EXEC.
 	  if (ehdr->e_type != ET_EXEC && dwfl_module_relocations (m) > 0)
@@ -5567,6 +5956,17 @@ static void get_unwind_data (Dwfl_Module *m,
         break;
     }
 
+  // The raw data of relocatable files (kernel modules) isn't relocated
+  // yet, so their FDE addresses can't be determined here.
+  if (eh_frame_seen && !eh_frame_hdr_seen && *eh_len > 0
+      && ehdr->e_type != ET_REL)
+    {
+      create_eh_frame_hdr (ehdr->e_ident, eh_data, *eh_addr, eh_sh_addr,
+			   eh_frame_hdr, eh_frame_hdr_len, session, m);
+      *eh_frame_hdr_addr = 0; // only absolute pointers are used
+      *eh_frame_hdr_synthesized = (*eh_frame_hdr != NULL);
+    }
+
   // fetch .debug_frame info preferably from dwarf debuginfo file.
   elf = (dwarf_getelf (dwfl_module_getdwarf (m, &bias))
 	 ?: dwfl_module_getelf (m, &bias));
@@ -5975,7 +6375,7 @@ dump_unwind_tables (Dwfl_Module *m,
 		   &c->eh_addr, &c->eh_frame_hdr, &c->eh_frame_hdr_len,
 		   &c->debug_frame_hdr, &c->debug_frame_hdr_len,
 		   &c->debug_frame_off, &c->eh_frame_hdr_addr,
-                   c->session);
+		   &c->eh_frame_hdr_synthesized, c->session);
   return DWARF_CB_OK;
 }
 
@@ -6258,7 +6658,9 @@ dump_unwindsym_cxt (Dwfl_Module *m,
   c->undone_unwindsym_modules.erase (modname);
 
   // release various malloc'd tables
-  // if (eh_frame_hdr) free (eh_frame_hdr); -- nope, this one comes from the elf image in memory
+  // eh_frame_hdr normally comes from the elf image in memory, only
+  // free it when we synthesized it ourselves.
+  if (eh_frame_hdr && c->eh_frame_hdr_synthesized) free (eh_frame_hdr);
   if (debug_frame_hdr) free (debug_frame_hdr);
 
   return DWARF_CB_OK;
@@ -6325,6 +6727,7 @@ dump_unwindsyms (Dwfl_Module *m,
   c->eh_frame_hdr_len = 0;
   c->eh_addr = 0;
   c->eh_frame_hdr_addr = 0;
+  c->eh_frame_hdr_synthesized = false;
   if (res == DWARF_CB_OK && c->session.need_unwind)
     res = dump_unwind_tables (m, c, name, base);
 
@@ -6478,6 +6881,7 @@ emit_symbol_data (systemtap_session& s)
 				 0, /* eh_frame_hdr_len */
 				 0, /* eh_addr */
 				 0, /* eh_frame_hdr_addr */
+				 false, /* eh_frame_hdr_synthesized */
 				 s.unwindsym_modules };
 
   // Micro optimization, mainly to speed up tiny regression tests
@@ -6733,6 +7137,8 @@ translate_pass (systemtap_session& s)
       // regexp subexpressions:
       s.op->newline() << "#define STAPREGEX_MAX_STATE" << s.dfa_maxstate;
       s.op->newline() << "#define STAPREGEX_MAX_TAG" << s.dfa_maxtag;
+      if (!s.dfa_sets.empty())
+        s.op->newline() << "#define STAP_NEED_CONTEXT_REGEX_SET 1";
 
       s.op->newline() << "#define STP_SKIP_BADVARS " << (s.skip_badvars ? 1 : 0);
 
@@ -6826,6 +7232,13 @@ translate_pass (systemtap_session& s)
               s.print_error(e);
             }
         }
+      for (map<string,stapdfa_set*>::iterator it = s.dfa_sets.begin();
+           it != s.dfa_sets.end(); it++)
+        {
+          assert_no_interrupts();
+          s.op->newline();
+          it->second->emit_declaration (s.op);
+        }
       s.op->assert_0_indent();
 
       for (map<string,functiondecl*>::iterator it = s.functions.begin(); it != s.functions.end(); it++)
@@ -815,42 +815,54 @@ localization_variables()
   return localeVars;
 }
 
-// Runs a command with a saved PID, so we can kill it from the signal handler,
-// and wait for it to finish.
-int
-stap_system(int verbose, const string& description,
-            const vector<string>& args,
-            bool null_out, bool null_err)
+// Spawns a command with a saved PID, optionally with its stdout and/or
+// stderr sent to /dev/null.  The caller must stap_wait() for it.
+pid_t
+stap_spawn_quiet(int verbose, const vector<string>& args,
+                 bool null_out, bool null_err)
 {
-  int ret = 0;
+  pid_t pid = -1;
   posix_spawn_file_actions_t fa;
   if (posix_spawn_file_actions_init(&fa) != 0)
     return -1;
 
-  if ((null_out && null_child_fd(&fa, 1) != 0) ||
-      (null_err && null_child_fd(&fa, 2) != 0))
-    ret = -1;
-  else
-    {
-      pid_t pid = stap_spawn(verbose, args, &fa);
-      ret = pid;
-      if (pid > 0){
-        ret = stap_waitpid(verbose, pid);
-
-        // XXX PR13274 needs-session to use print_warning()
-        if (ret > 128)
-          clog << _F("WARNING: %s exited with signal: %d (%s)",
-                     description.c_str(), ret - 128, strsignal(ret - 128)) << endl;
-        else if (ret > 0)
-          clog << _F("WARNING: %s exited with status: %d",
-                     description.c_str(), ret) << endl;
-      }
-    }
+  if ((!null_out || null_child_fd(&fa, 1) == 0) &&
+      (!null_err || null_child_fd(&fa, 2) == 0))
+    pid = stap_spawn(verbose, args, &fa);
 
   posix_spawn_file_actions_destroy(&fa);
+  return pid;
+}
+
+// Waits for a spawned command, and warns if it didn't exit cleanly.
+int
+stap_wait(int verbose, const string& description, pid_t pid)
+{
+  int ret = stap_waitpid(verbose, pid);
+
+  // XXX PR13274 needs-session to use print_warning()
+  if (ret > 128)
+    clog << _F("WARNING: %s exited with signal: %d (%s)",
+               description.c_str(), ret - 128, strsignal(ret - 128)) << endl;
+  else if (ret > 0)
+    clog << _F("WARNING: %s exited with status: %d",
+               description.c_str(), ret) << endl;
   return ret;
 }
 
+// Runs a command with a saved PID, so we can kill it from the signal handler,
+// and wait for it to finish.
+int
+stap_system(int verbose, const string& description,
+            const vector<string>& args,
+            bool null_out, bool null_err)
+{
+  pid_t pid = stap_spawn_quiet(verbose, args, null_out, null_err);
+  if (pid > 0)
+    return stap_wait(verbose, description, pid);
+  return pid;
+}
+
 // Like stap_system, but capture stdout
 int
 stap_system_read(int verbose, const vector<string>& args, ostream& out)
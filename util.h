@@ -79,6 +79,9 @@ pid_t stap_spawn(int verbose, const std::vector<std::string>& args,
 		 posix_spawn_file_actions_t* fa, const std::vector<std::string>& envVec = std::vector<std::string> ());
 pid_t stap_spawn_piped(int verbose, const std::vector<std::string>& args,
                        int* child_in=NULL, int* child_out=NULL, int* child_err=NULL);
+pid_t stap_spawn_quiet(int verbose, const std::vector<std::string>& args,
+                       bool null_out=false, bool null_err=false);
+int stap_wait(int verbose, const std::string& description, pid_t pid);
 int stap_system(int verbose, const std::string& description,
                 const std::vector<std::string>& args,
                 bool null_out=false, bool null_err=false);